@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Benchmark matrix over generated modules: one module per stress preset and
+# function count, every scheduler, JSON/CSV results per module in OUT_DIR.
+# Run ./build.sh first.
+
+BIN_DIR=$(dirname "$0")
+OUT_DIR="${OUT_DIR:-bench}"
+FUNC_COUNTS="${FUNC_COUNTS:-100 1000}"
+PRESETS="${PRESETS:-liveness points-to 0-CFA slicing}"
+SCHEDULERS="${SCHEDULERS:-sequential,passes,funcs,tasks,tasks-lpt,stealing,stealing-funcs,modules,lazy,scc-waves}"
+THREADS="${THREADS:-1,2,4,8,16}"
+REPS="${REPS:-5}"
+# extra irgen options, e.g. "--bb-dist=pareto"
+GEN_FLAGS="${GEN_FLAGS:-}"
+
+mkdir -p "$OUT_DIR"
+
+for PRESET in $PRESETS; do
+    for FUNCS in $FUNC_COUNTS; do
+        NAME="$OUT_DIR/$PRESET-$FUNCS"
+        "$BIN_DIR/irgen" --stress=$PRESET --funcs=$FUNCS $GEN_FLAGS -o "$NAME.bc"
+        if [ $? -ne 0 ]; then
+            echo "fail: irgen $PRESET $FUNCS"
+            exit 1
+        fi
+        "$BIN_DIR/passman" "$NAME.bc" --scheduler=$SCHEDULERS --nthreads=$THREADS \
+            --reps=$REPS --json="$NAME.json" --csv="$NAME.csv"
+        if [ $? -ne 0 ]; then
+            echo "fail: passman $NAME.bc"
+            exit 1
+        fi
+    done
+done
+
+echo ""
+echo "success: results in $OUT_DIR"
@@ -3,9 +3,12 @@
 CXX=g++
 CXXFLAGS="-O3"
 LLVM_FLAGS="`llvm-config --cxxflags --ldflags --system-libs --libs all`"
-# CUSTOM_FLAGS="-DPRINT_STATS"
+# older llvm-config still reports -std=c++14, the sources need C++17
+STD_FLAGS="-std=c++17"
+# CUSTOM_FLAGS="-DPRINT_STATS -DVERIFY_PASSES"
 
 SRC_DIR="src"
+TOOLS_DIR="tools"
 
 OUTPUT_EXEC="passman"
 
@@ -15,9 +18,9 @@ echo "Found sources:"
 echo "$SOURCE_FILES" | sed 's/^/  /'
 echo ""
 
-# echo "$CXX $CXXFLAGS $CUSTOM_FLAGS $SOURCE_FILES $LLVM_FLAGS -o $OUTPUT_EXEC"
+# echo "$CXX $CXXFLAGS $CUSTOM_FLAGS $SOURCE_FILES $LLVM_FLAGS $STD_FLAGS -o $OUTPUT_EXEC"
 
-$CXX $CXXFLAGS $CUSTOM_FLAGS $SOURCE_FILES $LLVM_FLAGS -o $OUTPUT_EXEC
+$CXX $CXXFLAGS $CUSTOM_FLAGS $SOURCE_FILES $LLVM_FLAGS $STD_FLAGS -o $OUTPUT_EXEC
 
 if [ $? -eq 0 ]; then
     echo ""
@@ -26,4 +29,15 @@ else
     echo ""
     echo "fail"
     exit 1
-fi
\ No newline at end of file
+fi
+
+# standalone tools, one executable per source
+for TOOL in $(find "$TOOLS_DIR" -name "*.cpp"); do
+    TOOL_EXEC=$(basename "$TOOL" .cpp)
+    $CXX $CXXFLAGS $CUSTOM_FLAGS "$TOOL" $LLVM_FLAGS $STD_FLAGS -o $TOOL_EXEC
+    if [ $? -ne 0 ]; then
+        echo "fail: $TOOL_EXEC"
+        exit 1
+    fi
+    echo "success: $TOOL_EXEC"
+done
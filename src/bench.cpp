@@ -0,0 +1,242 @@
+#include "bench.hpp"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+using namespace llvm;
+
+long medianOf(std::vector<long> sorted) {
+  std::sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+  return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+void summarize(BenchResult &result) {
+  if (!result.loadTimes.empty())
+    result.loadMedian = medianOf(result.loadTimes);
+  auto sorted = result.times;
+  if (sorted.empty())
+    return;
+  std::sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+  result.min = sorted[0];
+  result.median = medianOf(sorted);
+  // nearest rank
+  size_t rank = std::ceil(0.95 * n);
+  result.p95 = sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void computeSpeedups(std::vector<BenchResult> &results) {
+  for (auto &result : results) {
+    const BenchResult *base = nullptr;
+    for (auto &other : results) {
+      if (other.file != result.file)
+        continue;
+      if (other.scheduler == "sequential") {
+        base = &other;
+        break;
+      }
+      if (other.scheduler == result.scheduler &&
+          (!base || other.threads < base->threads))
+        base = &other;
+    }
+    if (!base || result.median <= 0)
+      continue;
+    result.speedup = double(base->median) / result.median;
+    result.efficiency = result.speedup / result.threads;
+  }
+}
+
+void printResults(const std::vector<BenchResult> &results) {
+  outs() << left_justify("file", 24) << " " << left_justify("scheduler", 16)
+         << right_justify("threads", 8) << right_justify("min us", 11)
+         << right_justify("median us", 11) << right_justify("p95 us", 11)
+         << right_justify("speedup", 9) << right_justify("eff", 7) << "\n";
+  for (auto &result : results) {
+    outs() << left_justify(sys::path::filename(result.file), 24) << " "
+           << left_justify(result.scheduler, 16)
+           << format("%8u %10ld %10ld %10ld %8.2f %6.2f\n", result.threads,
+                     result.min, result.median, result.p95, result.speedup,
+                     result.efficiency);
+    if (!result.loadTimes.empty())
+      outs() << "    load" << format(": %ld us median, not in the times\n",
+                                     result.loadMedian);
+    if (size_t lookups = result.cacheHits + result.cacheMisses) {
+      outs() << "    cache"
+             << format(": %5.1f%% hits (%zu/%zu), %ld us saved per run\n",
+                       100.0 * result.cacheHits / lookups, result.cacheHits,
+                       lookups,
+                       result.cacheSaved / long(std::max<size_t>(
+                                               result.times.size(), 1)));
+    }
+    for (auto &[pass, timing] : result.passes) {
+      outs() << "    " << left_justify(pass, 20)
+             << format("%10ld us busy %10zu allocs %10zu KB\n", timing.busy,
+                       timing.arenaAllocs, timing.arenaBytes / 1024);
+      if (result.counterNames.empty())
+        continue;
+      outs() << "    " << left_justify("", 20);
+      for (size_t i = 0; i < result.counterNames.size(); ++i) {
+        outs() << format(" %12llu ", (unsigned long long)timing.counters[i])
+               << result.counterNames[i];
+      }
+      outs() << "\n";
+    }
+  }
+}
+
+bool writeJSON(const std::vector<BenchResult> &results,
+               const std::string &filename) {
+  std::error_code EC;
+  raw_fd_ostream out(filename, EC);
+  if (EC) {
+    errs() << "Cannot write " << filename << ": " << EC.message() << "\n";
+    return false;
+  }
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attributeObject("build", [&] {
+#ifdef PRINT_STATS
+      J.attribute("print_stats", true);
+#else
+      J.attribute("print_stats", false);
+#endif
+#ifdef VERIFY_PASSES
+      J.attribute("verify_passes", true);
+#else
+      J.attribute("verify_passes", false);
+#endif
+      J.attribute("counters", PerfCounters::enabled()
+                                  ? PerfCounters::modeName()
+                                  : "off");
+    });
+    J.attributeArray("runs", [&] {
+      for (auto &result : results) {
+        J.object([&] {
+          J.attribute("file", result.file);
+          J.attribute("scheduler", result.scheduler);
+          J.attribute("threads", (int64_t)result.threads);
+          J.attributeArray("times_us", [&] {
+            for (long time : result.times) {
+              J.value((int64_t)time);
+            }
+          });
+          J.attribute("min_us", (int64_t)result.min);
+          J.attribute("median_us", (int64_t)result.median);
+          J.attribute("p95_us", (int64_t)result.p95);
+          J.attribute("speedup", result.speedup);
+          J.attribute("efficiency", result.efficiency);
+          if (!result.loadTimes.empty()) {
+            J.attributeArray("load_us", [&] {
+              for (long time : result.loadTimes) {
+                J.value((int64_t)time);
+              }
+            });
+            J.attribute("load_median_us", (int64_t)result.loadMedian);
+          }
+          if (result.cacheHits + result.cacheMisses > 0) {
+            J.attributeObject("cache", [&] {
+              J.attribute("hits", (int64_t)result.cacheHits);
+              J.attribute("misses", (int64_t)result.cacheMisses);
+              J.attribute("saved_us", (int64_t)result.cacheSaved);
+            });
+          }
+          J.attributeObject("passes", [&] {
+            for (auto &[pass, timing] : result.passes) {
+              J.attributeObject(pass, [&] {
+                J.attribute("busy_us", (int64_t)timing.busy);
+                J.attribute("arena_allocs", (int64_t)timing.arenaAllocs);
+                J.attribute("arena_bytes", (int64_t)timing.arenaBytes);
+                if (result.counterNames.empty())
+                  return;
+                J.attributeObject("counters", [&] {
+                  for (size_t i = 0; i < result.counterNames.size(); ++i) {
+                    J.attribute(result.counterNames[i],
+                                (int64_t)timing.counters[i]);
+                  }
+                });
+              });
+            }
+          });
+        });
+      }
+    });
+  });
+  out << "\n";
+  return true;
+}
+
+// One row per configuration, one busy-time column per pass seen in any of
+// them, and one column per pass and counter when counters were read.
+bool writeCSV(const std::vector<BenchResult> &results,
+              const std::string &filename) {
+  std::error_code EC;
+  raw_fd_ostream out(filename, EC);
+  if (EC) {
+    errs() << "Cannot write " << filename << ": " << EC.message() << "\n";
+    return false;
+  }
+  std::set<std::string> passes;
+  std::vector<std::string> counterNames;
+  bool cached = false, loaded = false;
+  for (auto &result : results) {
+    cached |= result.cacheHits + result.cacheMisses > 0;
+    loaded |= !result.loadTimes.empty();
+    for (auto &entry : result.passes) {
+      passes.insert(entry.first);
+    }
+    if (counterNames.empty())
+      counterNames = result.counterNames;
+  }
+  out << "file,scheduler,threads,reps,min_us,median_us,p95_us,speedup,"
+         "efficiency";
+  if (loaded)
+    out << ",load_median_us";
+  if (cached)
+    out << ",cache_hits,cache_misses,cache_saved_us";
+  for (auto &pass : passes) {
+    out << "," << pass << "_us";
+  }
+  for (auto &pass : passes) {
+    for (auto &counter : counterNames) {
+      out << "," << pass << "_" << counter;
+    }
+  }
+  out << "\n";
+  for (auto &result : results) {
+    out << result.file << "," << result.scheduler << "," << result.threads
+        << "," << result.times.size() << "," << result.min << ","
+        << result.median << "," << result.p95 << ","
+        << format("%.4f,%.4f", result.speedup, result.efficiency);
+    if (loaded) {
+      out << ",";
+      if (!result.loadTimes.empty())
+        out << result.loadMedian;
+    }
+    if (cached)
+      out << "," << result.cacheHits << "," << result.cacheMisses << ","
+          << result.cacheSaved;
+    for (auto &pass : passes) {
+      auto it = result.passes.find(pass);
+      out << ",";
+      if (it != result.passes.end())
+        out << it->second.busy;
+    }
+    for (auto &pass : passes) {
+      auto it = result.passes.find(pass);
+      for (size_t i = 0; i < counterNames.size(); ++i) {
+        out << ",";
+        if (it != result.passes.end() && !result.counterNames.empty())
+          out << it->second.counters[i];
+      }
+    }
+    out << "\n";
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "passes/counters.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Per-pass numbers of one benchmark configuration, medians over the
+// repetitions.
+struct PassTiming {
+  long busy = 0; // us summed over tasks
+  size_t arenaAllocs = 0;
+  size_t arenaBytes = 0;
+  CounterValues counters{}; // BenchResult::counterNames order
+};
+
+// One (input, scheduler, thread count) configuration and its repetitions.
+struct BenchResult {
+  std::string file;
+  std::string scheduler;
+  unsigned threads = 1;
+  std::vector<long> times; // wall us per repetition
+  // us per repetition the lazy schedulers spent loading, not in times
+  std::vector<long> loadTimes;
+  std::map<std::string, PassTiming> passes;
+  // empty unless perf counters were read
+  std::vector<std::string> counterNames;
+  // summed over the timed repetitions, zero without a cache
+  size_t cacheHits = 0, cacheMisses = 0;
+  long cacheSaved = 0; // us
+
+  long min = 0, median = 0, p95 = 0;
+  long loadMedian = 0;
+  double speedup = 0, efficiency = 0;
+};
+
+// Fill min/median/p95 from times and loadMedian from loadTimes.
+void summarize(BenchResult &result);
+
+// Speedup of every result against the sequential median on the same file,
+// or against the run of the same scheduler with the fewest threads when
+// sequential was not measured; efficiency is speedup per thread.
+void computeSpeedups(std::vector<BenchResult> &results);
+
+void printResults(const std::vector<BenchResult> &results);
+bool writeJSON(const std::vector<BenchResult> &results,
+               const std::string &filename);
+bool writeCSV(const std::vector<BenchResult> &results,
+              const std::string &filename);
@@ -0,0 +1,234 @@
+#include "costmodel.hpp"
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <sstream>
+
+using namespace llvm;
+
+const std::array<const char *, FuncFeatures::count> FuncFeatures::names = {
+    "size", "insts", "phis", "loads", "stores", "calls"};
+
+FuncFeatures FuncFeatures::of(Function &func) {
+  FuncFeatures features;
+  auto &v = features.values;
+  v[0] = func.size();
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      v[1]++;
+      if (isa<PHINode>(inst))
+        v[2]++;
+      else if (isa<LoadInst>(inst))
+        v[3]++;
+      else if (isa<StoreInst>(inst))
+        v[4]++;
+      else if (isa<CallBase>(inst))
+        v[5]++;
+    }
+  }
+  return features;
+}
+
+// bias, features, insts * bbs, insts^2
+constexpr int nterms = FuncFeatures::count + 3;
+
+std::array<double, nterms> terms(const FuncFeatures &features) {
+  std::array<double, nterms> x;
+  x[0] = 1;
+  for (int i = 0; i < FuncFeatures::count; ++i) {
+    x[i + 1] = features.values[i];
+  }
+  x[FuncFeatures::count + 1] = features.insts() * features.bbs();
+  x[FuncFeatures::count + 2] = features.insts() * features.insts();
+  return x;
+}
+
+std::vector<std::string> splitCSV(const std::string &line) {
+  std::vector<std::string> fields;
+  std::stringstream ss(line);
+  std::string field;
+  while (std::getline(ss, field, ',')) {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+// Solve (X^T X + ridge) w = X^T y on columns scaled to [0, 1].
+std::vector<double>
+fitLeastSquares(const std::vector<std::array<double, nterms>> &X,
+                const std::vector<double> &y) {
+  std::array<double, nterms> scale;
+  scale.fill(0);
+  for (auto &row : X) {
+    for (int j = 0; j < nterms; ++j) {
+      scale[j] = std::max(scale[j], std::fabs(row[j]));
+    }
+  }
+  for (auto &s : scale) {
+    if (s == 0)
+      s = 1;
+  }
+
+  double A[nterms][nterms + 1] = {};
+  for (size_t r = 0; r < X.size(); ++r) {
+    for (int i = 0; i < nterms; ++i) {
+      double xi = X[r][i] / scale[i];
+      for (int j = 0; j < nterms; ++j) {
+        A[i][j] += xi * X[r][j] / scale[j];
+      }
+      A[i][nterms] += xi * y[r];
+    }
+  }
+  for (int i = 0; i < nterms; ++i) {
+    A[i][i] += 1e-6 * (X.size() + 1);
+  }
+
+  // Gaussian elimination with partial pivoting
+  for (int c = 0; c < nterms; ++c) {
+    int pivot = c;
+    for (int r = c + 1; r < nterms; ++r) {
+      if (std::fabs(A[r][c]) > std::fabs(A[pivot][c]))
+        pivot = r;
+    }
+    std::swap(A[c], A[pivot]);
+    for (int r = 0; r < nterms; ++r) {
+      if (r == c || A[c][c] == 0)
+        continue;
+      double f = A[r][c] / A[c][c];
+      for (int k = c; k <= nterms; ++k) {
+        A[r][k] -= f * A[c][k];
+      }
+    }
+  }
+
+  std::vector<double> w(nterms, 0);
+  for (int i = 0; i < nterms; ++i) {
+    if (A[i][i] != 0)
+      w[i] = A[i][nterms] / A[i][i] / scale[i];
+  }
+  return w;
+}
+
+bool CostModel::train(const std::string &csvname) {
+  std::ifstream csv(csvname);
+  std::string line;
+  if (!csv || !std::getline(csv, line)) {
+    errs() << "Cannot read task times from " << csvname << "\n";
+    return false;
+  }
+
+  // name, then any of the feature columns, then one column per pass, then
+  // pass:counter columns, which are not times
+  auto header = splitCSV(line);
+  std::array<int, FuncFeatures::count> featureCols;
+  featureCols.fill(-1);
+  std::vector<std::pair<std::string, int>> passCols;
+  for (size_t c = 1; c < header.size(); ++c) {
+    auto name = std::find(FuncFeatures::names.begin(),
+                          FuncFeatures::names.end(), header[c]);
+    if (name != FuncFeatures::names.end())
+      featureCols[name - FuncFeatures::names.begin()] = c;
+    else if (header[c].find(':') == std::string::npos)
+      passCols.push_back({header[c], c});
+  }
+
+  std::vector<std::array<double, nterms>> X;
+  std::vector<std::vector<double>> Y(passCols.size());
+  while (std::getline(csv, line)) {
+    auto fields = splitCSV(line);
+    if (fields.size() != header.size())
+      continue;
+    FuncFeatures features;
+    for (int i = 0; i < FuncFeatures::count; ++i) {
+      if (featureCols[i] >= 0)
+        features.values[i] =
+            std::strtod(fields[featureCols[i]].c_str(), nullptr);
+    }
+    X.push_back(terms(features));
+    for (size_t p = 0; p < passCols.size(); ++p) {
+      auto &time = fields[passCols[p].second];
+      Y[p].push_back(std::strtod(time.c_str(), nullptr));
+    }
+  }
+  if (X.empty()) {
+    errs() << "No task times in " << csvname << "\n";
+    return false;
+  }
+
+  for (size_t p = 0; p < passCols.size(); ++p) {
+    coefs[passCols[p].first] = fitLeastSquares(X, Y[p]);
+  }
+  return true;
+}
+
+bool CostModel::save(const std::string &filename) const {
+  std::ofstream out(filename);
+  if (!out) {
+    errs() << "Cannot write cost model to " << filename << "\n";
+    return false;
+  }
+  out.precision(17);
+  for (auto &[pass, w] : coefs) {
+    out << pass;
+    for (double c : w) {
+      out << " " << c;
+    }
+    out << "\n";
+  }
+  return true;
+}
+
+bool CostModel::load(const std::string &filename) {
+  std::ifstream in(filename);
+  if (!in) {
+    errs() << "Cannot read cost model from " << filename << "\n";
+    return false;
+  }
+  coefs.clear();
+  std::string pass;
+  while (in >> pass) {
+    std::vector<double> w(nterms);
+    for (auto &c : w) {
+      in >> c;
+    }
+    coefs[pass] = w;
+  }
+  return true;
+}
+
+double CostModel::predict(const std::string &pass,
+                          const FuncFeatures &features) const {
+  auto it = coefs.find(pass);
+  if (it == coefs.end())
+    return features.bbs();
+  auto x = terms(features);
+  double cost = 0;
+  for (int i = 0; i < nterms; ++i) {
+    cost += it->second[i] * x[i];
+  }
+  return std::max(cost, 0.0);
+}
+
+double lptMakespan(std::vector<double> costs, unsigned nthreads) {
+  std::sort(costs.begin(), costs.end(), std::greater<double>());
+  std::priority_queue<double, std::vector<double>, std::greater<double>>
+      loads;
+  for (unsigned i = 0; i < nthreads; ++i) {
+    loads.push(0);
+  }
+  double makespan = 0;
+  for (double cost : costs) {
+    double load = loads.top() + cost;
+    loads.pop();
+    loads.push(load);
+    makespan = std::max(makespan, load);
+  }
+  return makespan;
+}
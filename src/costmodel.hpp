@@ -0,0 +1,43 @@
+#pragma once
+
+#include "llvm/IR/Function.h"
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+// Static shape of a function used to predict how long a pass takes on it.
+struct FuncFeatures {
+  static constexpr int count = 6;
+  static const std::array<const char *, count> names;
+
+  // bbs, insts, phis, loads, stores, calls; same order as names
+  std::array<double, count> values{};
+
+  static FuncFeatures of(llvm::Function &func);
+  double bbs() const { return values[0]; }
+  double insts() const { return values[1]; }
+};
+
+// Per-pass least-squares fit of task time (us) against the features plus
+// two quadratic terms, trained from the csv TaskTimer writes. Passes the
+// model has not seen fall back to the basic-block count, which is in other
+// units, so a model is only used for passes it covers.
+class CostModel {
+private:
+  std::map<std::string, std::vector<double>> coefs;
+
+public:
+  bool train(const std::string &csvname);
+  bool save(const std::string &filename) const;
+  bool load(const std::string &filename);
+
+  bool empty() const { return coefs.empty(); }
+  bool covers(const std::string &pass) const { return coefs.count(pass); }
+  double predict(const std::string &pass, const FuncFeatures &features) const;
+};
+
+// Makespan of greedy longest-processing-time-first list scheduling of costs
+// on nthreads workers.
+double lptMakespan(std::vector<double> costs, unsigned nthreads);
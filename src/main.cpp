@@ -1,119 +1,494 @@
+#include "bench.hpp"
+#include "costmodel.hpp"
 #include "passes/passes.hpp"
+#include "passes/resultfile.hpp"
+#include "passes/trace.hpp"
 #include "passman.hpp"
 #include "scheduler.hpp"
+#include "threadpool.hpp"
 
-#include "llvm/IR/Argument.h"
-#include "llvm/IR/Function.h"
-#include "llvm/IR/Instruction.h"
-#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/Value.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
-#include "llvm/Support/JSON.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <chrono>
-#include <queue>
-// #include <set>
-// #include <unordered_map>
-#include <cmath>
-#include <fstream>
-#include <mutex>
-#include <thread>
-#include <unordered_set>
+#include <memory>
+#include <string>
 #include <vector>
 
 using namespace llvm;
 
+static cl::OptionCategory BenchCategory("passman options");
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+                                        cl::desc("<IR files>"),
+                                        cl::cat(BenchCategory));
+
+static cl::list<std::string> SchedulerNames(
+    "scheduler", cl::CommaSeparated,
+    cl::desc("Schedulers to run: sequential, passes, funcs, tasks, "
+             "tasks-lpt, stealing, stealing-funcs, modules, lazy, "
+             "lazy-eager, lazy-demat, scc-waves, scc-waves-td (default: "
+             "sequential,tasks)"),
+    cl::cat(BenchCategory));
+
+static cl::list<unsigned>
+    ThreadCounts("nthreads", cl::CommaSeparated,
+                 cl::desc("Thread counts (default: 1,2,4,8,16)"),
+                 cl::cat(BenchCategory));
+
+static cl::list<std::string>
+    PassNames("passes", cl::CommaSeparated,
+              cl::desc("Passes to run: liveness, liveness-bv, "
+                       "liveness-query, liveness-loops, points-to, "
+                       "points-to-set, points-to-steens, 0-CFA, 0-CFA-ipa, "
+                       "slicing, slicing-bfs (default: liveness,points-to,"
+                       "0-CFA,slicing)"),
+              cl::cat(BenchCategory));
+
+static cl::list<std::string> ModulePassNames(
+    "module-passes", cl::CommaSeparated,
+    cl::desc("Whole-module passes run after the passes of every run: "
+             "andersen, steensgaard (default: none)"),
+    cl::cat(BenchCategory));
+
+static cl::opt<unsigned> Warmup("warmup", cl::init(1),
+                                cl::desc("Untimed runs per configuration"),
+                                cl::cat(BenchCategory));
+
+static cl::opt<unsigned> Reps("reps", cl::init(5),
+                              cl::desc("Timed runs per configuration"),
+                              cl::cat(BenchCategory));
+
+static cl::opt<std::string> JSONFile("json", cl::desc("Write results as JSON"),
+                                     cl::value_desc("filename"),
+                                     cl::cat(BenchCategory));
+
+static cl::opt<std::string> CSVFile("csv", cl::desc("Write results as CSV"),
+                                    cl::value_desc("filename"),
+                                    cl::cat(BenchCategory));
+
+static cl::opt<std::string>
+    TraceFile("trace",
+              cl::desc("Write a Chrome trace of the timed runs: tasks, "
+                       "queue waits and one span per repetition"),
+              cl::value_desc("filename"), cl::cat(BenchCategory));
+
+static cl::opt<bool>
+    Counters("counters",
+             cl::desc("Read perf_event_open counters around every task; "
+                      "hardware events when available, else software ones"),
+             cl::cat(BenchCategory));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Keep results on disk across runs and skip tasks "
+                      "whose function body and pass are cached there"),
+             cl::value_desc("directory"), cl::cat(BenchCategory));
+
+static cl::opt<std::string>
+    CostModelFile("cost-model",
+                  cl::desc("Cost model for tasks-lpt; trained on the first "
+                           "input with TaskTimer when not given"),
+                  cl::value_desc("filename"), cl::cat(BenchCategory));
+
+static cl::opt<std::string>
+    TaskTimesFile("task-times",
+                  cl::desc("Keep the task times the cost model is trained "
+                           "on (default: a temporary file)"),
+                  cl::value_desc("filename"), cl::cat(BenchCategory));
+
+static cl::opt<std::string>
+    SaveCostModelFile("save-cost-model",
+                      cl::desc("Write the trained cost model, for later "
+                               "--cost-model runs"),
+                      cl::value_desc("filename"), cl::cat(BenchCategory));
+
+static cl::opt<bool>
+    KeepResults("keep-results",
+                cl::desc("Attach a ResultStore to the passes while timing"),
+                cl::cat(BenchCategory));
+
+static cl::opt<std::string> ResultsFile(
+    "results-file",
+    cl::desc("Stream every run's results into a memory-mappable binary "
+             "file, left holding the last run's; implies --keep-results"),
+    cl::value_desc("filename"), cl::cat(BenchCategory));
+
+static cl::opt<unsigned> SplitBBs(
+    "split-bbs", cl::init(0),
+    cl::desc("With the tasks schedulers, split tasks on functions of at "
+             "least this many BBs into parallel parts (default: 0, never)"),
+    cl::cat(BenchCategory));
+
+std::shared_ptr<FuncPass> makePass(const std::string &name) {
+  if (name == "liveness")
+    return std::make_shared<LivenessAnalysis>(LivenessEngine::Set);
+  if (name == "liveness-bv")
+    return std::make_shared<LivenessAnalysis>(LivenessEngine::BitVector);
+  if (name == "liveness-query")
+    return std::make_shared<LivenessAnalysis>(LivenessEngine::Query);
+  if (name == "liveness-loops")
+    return std::make_shared<LivenessAnalysis>(LivenessEngine::LoopForest);
+  if (name == "points-to")
+    return std::make_shared<Points2Analysis>(Points2Engine::Sparse);
+  if (name == "points-to-set")
+    return std::make_shared<Points2Analysis>(Points2Engine::Set);
+  if (name == "points-to-steens")
+    return std::make_shared<Points2Analysis>(Points2Engine::Unification);
+  if (name == "0-CFA")
+    return std::make_shared<ZeroCFAnalysis>(CFAMode::Intraprocedural);
+  if (name == "0-CFA-ipa")
+    return std::make_shared<ZeroCFAnalysis>(CFAMode::Interprocedural);
+  if (name == "slicing")
+    return std::make_shared<Slicing>(SliceEngine::Condensed);
+  if (name == "slicing-bfs")
+    return std::make_shared<Slicing>(SliceEngine::Traversal);
+  return nullptr;
+}
+
+std::shared_ptr<ModulePass> makeModulePass(const std::string &name) {
+  if (name == "andersen")
+    return std::make_shared<ModulePoints2Analysis>(
+        ModulePoints2Engine::Inclusion);
+  if (name == "steensgaard")
+    return std::make_shared<ModulePoints2Analysis>(
+        ModulePoints2Engine::Unification);
+  return nullptr;
+}
+
+// nullptr for unknown names
+std::unique_ptr<Scheduler> makeScheduler(const std::string &name,
+                                         unsigned nthreads) {
+  if (name == "sequential")
+    return std::make_unique<Sequential>();
+  if (name == "passes")
+    return std::make_unique<ConcurrentPasses>();
+  if (name == "funcs")
+    return std::make_unique<ConcurrentFuncs>(nthreads);
+  if (name == "tasks" || name == "tasks-lpt")
+    return std::make_unique<ConcurrentTasks>(nthreads);
+  if (name == "stealing")
+    return std::make_unique<WorkStealingTasks>(nthreads);
+  if (name == "stealing-funcs")
+    return std::make_unique<WorkStealingTasks>(nthreads, true);
+  if (name == "modules")
+    return std::make_unique<ConcurrentModules>(nthreads);
+  if (name == "lazy")
+    return std::make_unique<LazyFuncs>(nthreads, LoadMode::Lazy);
+  if (name == "lazy-eager")
+    return std::make_unique<LazyFuncs>(nthreads, LoadMode::Eager);
+  if (name == "lazy-demat")
+    return std::make_unique<LazyFuncs>(nthreads, LoadMode::LazyDematerialize);
+  if (name == "scc-waves")
+    return std::make_unique<CallGraphWaves>(nthreads, WaveOrder::BottomUp);
+  if (name == "scc-waves-td")
+    return std::make_unique<CallGraphWaves>(nthreads, WaveOrder::TopDown);
+  return nullptr;
+}
+
 int main(int argc, char *argv[]) {
   InitLLVM X(argc, argv);
-  if (argc < 2) {
-    errs() << "Expect IR filename\n";
+  cl::HideUnrelatedOptions(BenchCategory);
+  cl::ParseCommandLineOptions(argc, argv, "passman benchmark driver\n");
+
+  std::vector<std::string> schedulers(SchedulerNames.begin(),
+                                      SchedulerNames.end());
+  if (schedulers.empty())
+    schedulers = {"sequential", "tasks"};
+  std::vector<unsigned> threadCounts(ThreadCounts.begin(), ThreadCounts.end());
+  if (threadCounts.empty())
+    threadCounts = {1, 2, 4, 8, 16};
+  if (is_contained(threadCounts, 0u)) {
+    errs() << "Thread counts must be at least 1\n";
     return 1;
   }
-  char *filename = argv[1];
-
-  LLVMContext context;
-  SMDiagnostic smd;
-  std::unique_ptr<Module> module = parseIRFile(filename, smd, context);
-  if (!module) {
-    outs() << "Cannot parse IR file\n";
-    smd.print(filename, outs());
-    exit(1);
+  std::vector<std::string> passNames(PassNames.begin(), PassNames.end());
+  if (passNames.empty())
+    passNames = {"liveness", "points-to", "0-CFA", "slicing"};
+
+  std::shared_ptr<AnalysisCache> cache;
+  if (!CacheDir.empty()) {
+    cache = std::make_shared<AnalysisCache>(CacheDir);
+    if (!cache->init())
+      return 1;
   }
 
   PassMan passman;
-  passman.setPasses({
-      std::make_shared<LivenessAnalysis>(),
-      std::make_shared<Points2Analysis>(),
-      std::make_shared<ZeroCFAnalysis>(),
-      std::make_shared<Slicing>(),
-  });
-
-  // TaskTimer tt;
-  // outs() << "Task timer: " << module->getModuleIdentifier() << "\n";
-  // auto start = std::chrono::high_resolution_clock::now();
-  // tt.run(passman.getPasses(), *module);
-  // auto end = std::chrono::high_resolution_clock::now();
-  // auto duration =
-  //     std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  // outs() << "Analysis time: " << duration.count() << " us\n";
-
-  Sequential sequential;
-  outs() << "Sequential: " << module->getModuleIdentifier() << "\n";
-  auto start = std::chrono::high_resolution_clock::now();
-  sequential.run(passman.getPasses(), *module);
-  auto end = std::chrono::high_resolution_clock::now();
-  auto duration =
-      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  outs() << "Analysis time: " << duration.count() << " us\n";
-
-  // ConcurrentPasses concurrentPasses;
-  // outs() << "Passes concurrently: " << module->getModuleIdentifier()
-  //        << "\n";
-  // start = std::chrono::high_resolution_clock::now();
-  // concurrentPasses.run(passman.getPasses(), *module);
-  // end = std::chrono::high_resolution_clock::now();
-  // duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  // outs() << "Analysis time: " << duration.count() << " us\n";
-
-  // ConcurrentFuncs concurrentFuncs;
-  // outs() << "Funcs concurrently: " << module->getModuleIdentifier()
-  //        << "\n";
-  // start = std::chrono::high_resolution_clock::now();
-  // concurrentFuncs.run(passman.getPasses(), *module);
-  // end = std::chrono::high_resolution_clock::now();
-  // duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  // outs() << "Analysis time: " << duration.count() << " us\n";
-
-  // ConcurrentTasks concurrentTasks;
-  // outs() << "Tasks concurrently: " << module->getModuleIdentifier() << "\n";
-  // start = std::chrono::high_resolution_clock::now();
-  // concurrentTasks.run(passman.getPasses(), *module);
-  // end = std::chrono::high_resolution_clock::now();
-  // duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  // outs() << "Analysis time: " << duration.count() << " us\n";
-
-  for (int t = 1; t <= 16; ++t) {
-    ConcurrentTasks concurrentTasks_t(t);
-    outs() << "Tasks concurrently, t=" << t << ": "
-           << module->getModuleIdentifier() << "\n";
-    start = std::chrono::high_resolution_clock::now();
-    concurrentTasks_t.run(passman.getPasses(), *module);
-    end = std::chrono::high_resolution_clock::now();
-    duration =
-        std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-    outs() << "Analysis time: " << duration.count() << " us\n";
+  std::vector<std::shared_ptr<FuncPass>> passes;
+  for (auto &name : passNames) {
+    auto pass = makePass(name);
+    if (!pass) {
+      errs() << "Unknown pass " << name << "\n";
+      return 1;
+    }
+    pass->setCache(cache);
+    passes.push_back(pass);
+  }
+  passman.setPasses(passes);
+  std::vector<std::shared_ptr<ModulePass>> modulePasses;
+  for (auto &name : ModulePassNames) {
+    auto pass = makeModulePass(name);
+    if (!pass) {
+      errs() << "Unknown module pass " << name << "\n";
+      return 1;
+    }
+    modulePasses.push_back(pass);
+  }
+  passman.setModulePasses(modulePasses);
+  // a function goes into the results file once every pass put its sets
+  std::vector<ResultKind> resultKinds;
+  for (auto &pass : passes) {
+    auto kinds = pass->resultKinds();
+    resultKinds.insert(resultKinds.end(), kinds.begin(), kinds.end());
+  }
+  for (auto &pass : modulePasses) {
+    auto kinds = pass->resultKinds();
+    resultKinds.insert(resultKinds.end(), kinds.begin(), kinds.end());
+  }
+  // modules and the lazy schedulers run passes on partitions or on copies
+  // they load themselves and never prepare() them on the whole module
+  bool interprocedural = is_contained(passNames, "0-CFA-ipa");
+  for (auto &name : schedulers) {
+    if (!makeScheduler(name, 1)) {
+      errs() << "Unknown scheduler " << name << "\n";
+      return 1;
+    }
+    bool lazy = StringRef(name).startswith("lazy");
+    if (interprocedural && (name == "modules" || lazy)) {
+      errs() << "0-CFA-ipa needs the whole module and cannot run under "
+             << name << "\n";
+      return 1;
+    }
+    // module passes run after the scheduler, on bodies lazy-demat deleted
+    if (name == "lazy-demat" && !modulePasses.empty()) {
+      errs() << "Module passes cannot run under lazy-demat\n";
+      return 1;
+    }
+  }
+
+  unsigned maxThreads =
+      *std::max_element(threadCounts.begin(), threadCounts.end());
+  ThreadPool pool(maxThreads);
+  CostModel costModel;
+  if (!CostModelFile.empty() && !costModel.load(CostModelFile))
+    return 1;
+  for (auto &pass : passes) {
+    if (!costModel.empty() && !costModel.covers(pass->name())) {
+      errs() << "Cost model " << CostModelFile << " has no pass "
+             << pass->name() << "\n";
+      return 1;
+    }
   }
 
-  // ConcurrentModules concurrentModules;
-  // outs() << "Modules concurrently: " << module->getModuleIdentifier() << "\n";
-  // start = std::chrono::high_resolution_clock::now();
-  // concurrentModules.runOnFile(passman.getPasses(), filename);
-  // end = std::chrono::high_resolution_clock::now();
-  // duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-  // outs() << "Analysis time: " << duration.count() << " us\n";
+  if (Counters) {
+    PerfCounters::enable();
+    if (PerfCounters::mode() == CounterMode::None) {
+      errs() << "perf_event_open is not available, no counters\n";
+    } else {
+      outs() << "Counters (" << PerfCounters::modeName() << "):";
+      for (auto &counter : PerfCounters::names()) {
+        outs() << " " << counter;
+      }
+      outs() << "\n";
+    }
+  }
+
+  std::vector<BenchResult> results;
+  Trace::clear();
+  for (auto &filename : InputFiles) {
+    LLVMContext context;
+    SMDiagnostic smd;
+    std::unique_ptr<Module> module = parseIRFile(filename, smd, context);
+    if (!module) {
+      outs() << "Cannot parse IR file\n";
+      smd.print(filename.c_str(), outs());
+      exit(1);
+    }
+
+    for (auto &name : schedulers) {
+      if (name == "tasks-lpt" && costModel.empty()) {
+        // per-pass cost model trained on this module's task times, with
+        // the cache detached so that hits do not pass for task times
+        for (auto &pass : passes) {
+          pass->setCache(nullptr);
+        }
+        SmallString<128> csvname(TaskTimesFile);
+        if (TaskTimesFile.empty()) {
+          if (auto EC = sys::fs::createTemporaryFile("tasktime", "csv",
+                                                     csvname)) {
+            errs() << "Cannot create a task times file: " << EC.message()
+                   << "\n";
+            return 1;
+          }
+        }
+        TaskTimer tt(csvname.str().str());
+        tt.run(passman.getPasses(), *module);
+        for (auto &pass : passes) {
+          pass->release();
+          pass->setCache(cache);
+        }
+        bool trained = costModel.train(csvname.str().str());
+        if (TaskTimesFile.empty())
+          sys::fs::remove(csvname);
+        if (trained && !SaveCostModelFile.empty() &&
+            !costModel.save(SaveCostModelFile))
+          return 1;
+      }
+
+      // sequential ignores the thread count, passes uses one per pass
+      std::vector<unsigned> counts = threadCounts;
+      if (name == "sequential")
+        counts = {1};
+      else if (name == "passes")
+        counts = {unsigned(passes.size())};
+
+      for (unsigned nthreads : counts) {
+        auto scheduler = makeScheduler(name, nthreads);
+        scheduler->setPool(&pool);
+        for (auto &pass : modulePasses) {
+          pass->setThreads(nthreads);
+        }
+        if (name == "tasks-lpt")
+          scheduler->setCostModel(&costModel);
+        scheduler->setSplitBBs(SplitBBs);
+        bool written = true;
+        bool lazy = StringRef(name).startswith("lazy");
+        // us the last lazy load took
+        long loadTime = 0;
+        std::string span = name + " t=" + std::to_string(nthreads);
+        // wall us of the scheduler alone; module passes run after it and
+        // only report their busy time
+        auto runOnce = [&]() -> long {
+          // the lazy schedulers run on a module they load themselves,
+          // untimed, and results are kept for that one
+          LLVMContext lazyContext;
+          std::unique_ptr<Module> lazyModule;
+          Module *target = module.get();
+          if (lazy) {
+            auto &lazyFuncs = static_cast<LazyFuncs &>(*scheduler);
+            lazyModule = lazyFuncs.load(filename, lazyContext);
+            if (!lazyModule)
+              exit(1);
+            loadTime = lazyFuncs.lastLoadMicros();
+            target = lazyModule.get();
+          }
+          std::shared_ptr<ResultStore> store;
+          std::unique_ptr<ResultFileWriter> writer;
+          if (KeepResults || !ResultsFile.empty()) {
+            store = std::make_shared<ResultStore>(*target);
+            for (auto &pass : passes) {
+              pass->setResultStore(store);
+            }
+            for (auto &pass : modulePasses) {
+              pass->setResultStore(store);
+            }
+          }
+          if (!ResultsFile.empty()) {
+            writer = std::make_unique<ResultFileWriter>(*target);
+            if (writer->open(ResultsFile))
+              store->onComplete(resultKinds, [&](const Function &func) {
+                writer->add(func, *store);
+              });
+          }
+          uint64_t traceBegin = Trace::enabled() ? Trace::now() : 0;
+          auto start = std::chrono::high_resolution_clock::now();
+          scheduler->run(passman.getPasses(), *target);
+          auto end = std::chrono::high_resolution_clock::now();
+          if (Trace::enabled())
+            Trace::record("run", span, traceBegin, Trace::now());
+          passman.runModulePasses(*target);
+          for (auto &pass : passes) {
+            pass->setResultStore(nullptr);
+            pass->release();
+          }
+          for (auto &pass : modulePasses) {
+            pass->setResultStore(nullptr);
+          }
+          if (writer)
+            written &= writer->finish(*store);
+          return std::chrono::duration_cast<std::chrono::microseconds>(end -
+                                                                       start)
+              .count();
+        };
+
+        outs() << name << ", t=" << nthreads << ": " << filename << "\n";
+        for (unsigned w = 0; w < Warmup; ++w) {
+          runOnce();
+        }
+        // only the timed runs go into the trace
+        if (!TraceFile.empty())
+          Trace::enable();
 
+        BenchResult result;
+        result.file = filename;
+        result.scheduler = name;
+        result.threads = nthreads;
+        if (Counters)
+          result.counterNames = PerfCounters::names();
+        std::vector<std::vector<PassTiming>> timings(passes.size() +
+                                                     modulePasses.size());
+        for (unsigned r = 0; r < Reps; ++r) {
+          for (auto &pass : passes) {
+            pass->resetTaskStats();
+          }
+          for (auto &pass : modulePasses) {
+            pass->resetTaskStats();
+          }
+          if (cache)
+            cache->resetStats();
+          result.times.push_back(runOnce());
+          if (lazy)
+            result.loadTimes.push_back(loadTime);
+          if (cache) {
+            result.cacheHits += cache->hits();
+            result.cacheMisses += cache->misses();
+            result.cacheSaved += cache->savedMicros();
+          }
+          for (size_t p = 0; p < passes.size(); ++p) {
+            timings[p].push_back({passes[p]->busyMicros(),
+                                  passes[p]->arenaAllocations(),
+                                  passes[p]->arenaAllocatedBytes(),
+                                  passes[p]->counters()});
+          }
+          for (size_t p = 0; p < modulePasses.size(); ++p) {
+            timings[passes.size() + p].push_back(
+                {modulePasses[p]->busyMicros(), 0, 0, {}});
+          }
+        }
+        Trace::disable();
+        for (size_t p = 0; p < timings.size() && Reps > 0; ++p) {
+          auto &t = timings[p];
+          std::sort(t.begin(), t.end(),
+                    [](const PassTiming &a, const PassTiming &b) {
+                      return a.busy < b.busy;
+                    });
+          auto passName = p < passes.size()
+                              ? passes[p]->name()
+                              : modulePasses[p - passes.size()]->name();
+          result.passes[passName] = t[t.size() / 2];
+        }
+        summarize(result);
+        results.push_back(std::move(result));
+        if (!written)
+          return 1;
+      }
+    }
+  }
+
+  computeSpeedups(results);
+  printResults(results);
+  if (!JSONFile.empty() && !writeJSON(results, JSONFile))
+    return 1;
+  if (!CSVFile.empty() && !writeCSV(results, CSVFile))
+    return 1;
+  if (!TraceFile.empty() && !Trace::write(TraceFile))
+    return 1;
 }
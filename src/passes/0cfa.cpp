@@ -1,117 +1,148 @@
 #include "passes.hpp"
+#include "scc.hpp"
 
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
+#include <algorithm>
+#include <functional>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace llvm;
 
-struct LocalData {
-  std::unordered_map<Instruction *, DenseSet<Value *>> callMap;
-  std::unordered_map<Value *, DenseSet<Value *>> points2;
-  std::unordered_set<Value *> visited;
+// the maps live in the task arena, the DenseSets inside them do not
+struct CFALocalData {
+  std::pmr::unordered_map<Instruction *, DenseSet<Value *>> callMap{
+      taskArena()};
+  std::pmr::unordered_map<Value *, DenseSet<Value *>> points2{taskArena()};
+  std::pmr::unordered_set<Value *> visited{taskArena()};
+  // globals already solved module-wide, may be null
+  const GlobalPoints2 *globals = nullptr;
 };
 
-void analyzePtr(Value *val, LocalData &localdata) {
-  auto &callMap = localdata.callMap;
+// One pending analyzePtr call. deps are the values whose points-to sets flow
+// into val, in the order the recursive formulation visited them; the first
+// one is copied instead of merged when assignFirst is set.
+struct PtrFrame {
+  Value *val;
+  SmallVector<Value *, 4> deps;
+  unsigned next = 0;
+  bool assignFirst = false;
+};
+
+// Marks val visited, seeds its own points-to set and lists its deps.
+PtrFrame makeFrame(Value *val, CFALocalData &localdata) {
   auto &points2 = localdata.points2;
-  auto &visited = localdata.visited;
-  if (visited.find(val) != visited.end()) {
-    return;
-  }
-  visited.insert(val);
+  localdata.visited.insert(val);
+  PtrFrame frame{val};
 
   if (isa<Function>(val) || isa<Argument>(val)) {
     points2[val] = {val};
 
   } else if (auto *cast = dyn_cast<CastInst>(val)) {
-    auto *src = cast->getOperand(0);
-    analyzePtr(src, localdata);
-    points2[cast] = points2[src];
+    frame.deps.push_back(cast->getOperand(0));
+    frame.assignFirst = true;
 
   } else if (auto *phi = dyn_cast<PHINode>(val)) {
+    points2[phi];
     for (int i = 0; i < phi->getNumIncomingValues(); ++i) {
-      Value *inval = phi->getIncomingValue(i);
-      // if (isa<Instruction>(inval) || isa<Argument>(inval)) {
-      analyzePtr(inval, localdata);
-      points2[phi].insert(points2[inval].begin(), points2[inval].end());
-      // }
+      frame.deps.push_back(phi->getIncomingValue(i));
     }
 
   } else if (auto *select = dyn_cast<SelectInst>(val)) {
-    Value *tval = select->getTrueValue();
-    Value *fval = select->getFalseValue();
-    // if (isa<Instruction>(tval) || isa<Argument>(tval)) {
-    analyzePtr(tval, localdata);
-    points2[select].insert(points2[tval].begin(), points2[tval].end());
-    // }
-    // if (isa<Instruction>(fval) || isa<Argument>(fval)) {
-    analyzePtr(fval, localdata);
-    points2[select].insert(points2[fval].begin(), points2[fval].end());
-    // }
+    points2[select];
+    frame.deps.push_back(select->getTrueValue());
+    frame.deps.push_back(select->getFalseValue());
 
   } else if (auto *load = dyn_cast<LoadInst>(val)) {
     auto *loadptr = load->getPointerOperand();
-    analyzePtr(loadptr, localdata);
-    points2[load] = points2[loadptr];
+    frame.deps.push_back(loadptr);
+    frame.assignFirst = true;
     for (auto *user : loadptr->users()) {
       if (auto *store = dyn_cast<StoreInst>(user)) {
-        if (store->getPointerOperand() == loadptr) {
-          auto *stval = store->getValueOperand();
-          analyzePtr(stval, localdata);
-          points2[load].insert(points2[stval].begin(), points2[stval].end());
-        }
+        if (store->getPointerOperand() == loadptr)
+          frame.deps.push_back(store->getValueOperand());
       }
     }
 
   } else if (auto *global = dyn_cast<GlobalVariable>(val)) {
-    points2[val] = {val};
-    if (global->hasInitializer()) {
-      Value *initval = global->getInitializer();
-      analyzePtr(initval, localdata);
-      points2[val].insert(points2[initval].begin(), points2[initval].end());
+    if (localdata.globals) {
+      if (auto *summary = localdata.globals->lookup(global)) {
+        points2[val] = *summary;
+        return frame;
+      }
     }
+    points2[val] = {val};
+    if (global->hasInitializer())
+      frame.deps.push_back(global->getInitializer());
     for (auto *user : global->users()) {
       if (auto *store = dyn_cast<StoreInst>(user)) {
-        if (store->getPointerOperand() == global) {
-          Value *storedVal = store->getValueOperand();
-          analyzePtr(storedVal, localdata);
-          points2[val].insert(points2[storedVal].begin(),
-                              points2[storedVal].end());
-        }
+        if (store->getPointerOperand() == global)
+          frame.deps.push_back(store->getValueOperand());
       }
     }
 
   } else if (auto *gep = dyn_cast<GetElementPtrInst>(val)) {
-    Value *baseptr = gep->getPointerOperand();
-    analyzePtr(baseptr, localdata);
-    points2[gep] = points2[baseptr];
-
-    // } else if (auto *cexpr = dyn_cast<ConstantExpr>(val)) {
-    //   auto *ceinst = cexpr->getAsInstruction();
-    //   analyzePtr(ceinst, localdata);
-    //   points2[cexpr] = points2[ceinst];
-    //   points2.erase(ceinst);
-    //   ceinst->deleteValue();
+    frame.deps.push_back(gep->getPointerOperand());
+    frame.assignFirst = true;
 
   } else {
     points2[val] = {val};
   }
+  return frame;
 }
 
-void analyzeIntra(Function &func, LocalData &localdata) {
-  auto &callMap = localdata.callMap;
+// Depth-first over deps with an explicit stack, so long cast/phi/load chains
+// cannot overflow the native one. A dep that is already visited contributes
+// whatever it has so far, exactly like the recursive version did.
+void analyzePtr(Value *root, CFALocalData &localdata) {
   auto &points2 = localdata.points2;
   auto &visited = localdata.visited;
+  if (visited.find(root) != visited.end()) {
+    return;
+  }
+
+  std::vector<PtrFrame> stack;
+  stack.push_back(makeFrame(root, localdata));
+  while (!stack.empty()) {
+    PtrFrame &frame = stack.back();
+    if (frame.next > 0 && frame.deps[frame.next - 1] != frame.val) {
+      Value *dep = frame.deps[frame.next - 1];
+      auto &src = points2[dep];
+      auto &dst = points2[frame.val];
+      if (frame.next == 1 && frame.assignFirst)
+        dst = src;
+      else
+        dst.insert(src.begin(), src.end());
+    }
+    if (frame.next == frame.deps.size()) {
+      stack.pop_back();
+      continue;
+    }
+
+    Value *dep = frame.deps[frame.next++];
+    if (visited.find(dep) == visited.end())
+      stack.push_back(makeFrame(dep, localdata));
+  }
+}
+
+void analyzeIntra(Function &func, CFALocalData &localdata) {
+  auto &callMap = localdata.callMap;
+  auto &points2 = localdata.points2;
 
   for (auto &BB : func) {
     for (auto &inst : BB) {
@@ -124,7 +155,539 @@ void analyzeIntra(Function &func, LocalData &localdata) {
   }
 }
 
+const DenseSet<Value *> *
+GlobalPoints2::lookup(const GlobalVariable *global) const {
+  auto it = summaries.find(global);
+  return it == summaries.end() ? nullptr : &it->second;
+}
+
+// Every global is solved from scratch on its own, so the workers share
+// nothing but the read-only IR.
+std::shared_ptr<const GlobalPoints2>
+GlobalPoints2::compute(Module &module, unsigned nthreads,
+                       const WorkerRunner &runWorkers) {
+  std::vector<GlobalVariable *> globals;
+  for (auto &global : module.globals()) {
+    globals.push_back(&global);
+  }
+  nthreads = std::max(1u, std::min<unsigned>(nthreads, globals.size()));
+
+  std::vector<std::vector<DenseSet<Value *>>> results(nthreads);
+  runWorkers(nthreads, [&](int t) {
+    for (size_t i = t; i < globals.size(); i += nthreads) {
+      {
+        CFALocalData localdata;
+        analyzePtr(globals[i], localdata);
+        results[t].push_back(std::move(localdata.points2[globals[i]]));
+      }
+      TaskArena::local().reset();
+    }
+  });
+
+  auto table = std::make_shared<GlobalPoints2>();
+  table->module = &module;
+  for (unsigned t = 0; t < nthreads; ++t) {
+    for (size_t k = 0; k < results[t].size(); ++k) {
+      table->summaries[globals[t + k * nthreads]] = std::move(results[t][k]);
+    }
+  }
+  return table;
+}
+
+// Stores whose pointer is a constant expression built on val.
+void constantStores(const Value *val, SmallVectorImpl<const StoreInst *> &out) {
+  for (auto *user : val->users()) {
+    if (auto *store = dyn_cast<StoreInst>(user)) {
+      if (store->getPointerOperand() == val && isa<ConstantExpr>(val))
+        out.push_back(store);
+    } else if (isa<ConstantExpr>(user)) {
+      constantStores(user, out);
+    }
+  }
+}
+
+uint64_t GlobalPoints2::hash() const {
+  StableValueHasher hasher;
+  std::vector<uint64_t> words;
+  std::vector<uint64_t> set;
+  SmallVector<const StoreInst *, 8> stores;
+  for (auto &global : module->globals()) {
+    words.push_back(hasher.hash(&global));
+    if (auto *summary = lookup(&global)) {
+      set.clear();
+      for (auto *val : *summary) {
+        set.push_back(hasher.hash(val));
+      }
+      std::sort(set.begin(), set.end());
+      words.push_back(set.size());
+      words.insert(words.end(), set.begin(), set.end());
+    }
+    stores.clear();
+    constantStores(&global, stores);
+    set.clear();
+    for (auto *store : stores) {
+      set.push_back(hasher.hash(store->getPointerOperand()) ^
+                    hasher.hash(store->getValueOperand()) * 31);
+    }
+    std::sort(set.begin(), set.end());
+    words.push_back(set.size());
+    words.insert(words.end(), set.begin(), set.end());
+  }
+  return xxHash64(makeArrayRef(reinterpret_cast<const uint8_t *>(words.data()),
+                               words.size() * sizeof(uint64_t)));
+}
+
+// What one call site's operands point to, in its caller's terms.
+struct CallSiteSummary {
+  CallInst *call;
+  DenseSet<Value *> callee;
+  std::vector<DenseSet<Value *>> args;
+  // defined functions it may call, grows between rounds
+  std::vector<unsigned> targets;
+  // it may also call something outside the module, or nothing is known
+  bool external = true;
+  // what its result points to, in the caller's terms
+  DenseSet<Value *> results;
+  // callee after the last round, fully resolved
+  DenseSet<Value *> resolved;
+};
+
+struct FuncSummary {
+  Function *func;
+  std::vector<CallSiteSummary> calls;
+  DenseSet<Value *> localReturns;
+  // bottom-up, in terms of func's own arguments
+  DenseSet<Value *> returns;
+  // top-down, per argument
+  std::vector<DenseSet<Value *>> params;
+  // (function, call) of the call sites that may call func
+  std::vector<std::pair<unsigned, unsigned>> callers;
+};
+
+Function *definedFunction(Value *val) {
+  auto *func = dyn_cast<Function>(val->stripPointerCasts());
+  return func && !func->isDeclaration() ? func : nullptr;
+}
+
+// Arguments of functions that may be called from outside the module, or
+// through memory this analysis does not follow, stay placeholders.
+bool calledFromOutside(const Function &func) {
+  return !func.hasLocalLinkage() || func.hasAddressTaken();
+}
+
+void summarizeLocal(FuncSummary &summary, const GlobalPoints2 *globals) {
+  CFALocalData localdata;
+  localdata.globals = globals;
+  auto pointsTo = [&](Value *val) {
+    analyzePtr(val, localdata);
+    return localdata.points2[val];
+  };
+  for (auto &BB : *summary.func) {
+    for (auto &inst : BB) {
+      if (auto *call = dyn_cast<CallInst>(&inst)) {
+        CallSiteSummary site{call, pointsTo(call->getCalledOperand())};
+        for (auto &arg : call->args()) {
+          site.args.push_back(arg->getType()->isPointerTy()
+                                  ? pointsTo(arg)
+                                  : DenseSet<Value *>());
+        }
+        summary.calls.push_back(std::move(site));
+      } else if (auto *ret = dyn_cast<ReturnInst>(&inst)) {
+        Value *val = ret->getReturnValue();
+        if (val && val->getType()->isPointerTy()) {
+          auto set = pointsTo(val);
+          summary.localReturns.insert(set.begin(), set.end());
+        }
+      }
+    }
+  }
+}
+
+// Runs solve(scc) once for every SCC on nthreads workers, as soon as every
+// SCC in its waitsFor list is done.
+void runWaves(const std::vector<std::vector<unsigned>> &waitsFor,
+              unsigned nthreads, const WorkerRunner &runWorkers,
+              const std::function<void(unsigned)> &solve) {
+  WaveQueue queue(waitsFor);
+  runWorkers(nthreads, [&](int) {
+    unsigned scc;
+    while (queue.take(scc)) {
+      solve(scc);
+      queue.finish(scc);
+    }
+  });
+}
+
+struct InterprocSolver {
+  std::vector<FuncSummary> funcs;
+  DenseMap<const Function *, unsigned> funcIds;
+  // call -> (function, call)
+  DenseMap<const Value *, std::pair<unsigned, unsigned>> callIds;
+  // callees before callers
+  std::vector<std::vector<unsigned>> sccs;
+  std::vector<unsigned> sccOf;
+  unsigned nthreads;
+
+  // Call results of func's own calls replaced by what they point to.
+  void expandCalls(unsigned func, const DenseSet<Value *> &set,
+                   DenseSet<Value *> &out) const {
+    for (auto *val : set) {
+      auto it = callIds.find(val);
+      if (it != callIds.end() && it->second.first == func) {
+        auto &results = funcs[func].calls[it->second.second].results;
+        out.insert(results.begin(), results.end());
+      } else {
+        out.insert(val);
+      }
+    }
+  }
+
+  // func's own arguments replaced by what they point to.
+  void expandParams(unsigned func, const DenseSet<Value *> &set,
+                    DenseSet<Value *> &out) const {
+    for (auto *val : set) {
+      auto *arg = dyn_cast<Argument>(val);
+      if (arg && arg->getParent() == funcs[func].func) {
+        auto &param = funcs[func].params[arg->getArgNo()];
+        out.insert(param.begin(), param.end());
+      } else {
+        out.insert(val);
+      }
+    }
+  }
+
+  static bool merge(DenseSet<Value *> &into, const DenseSet<Value *> &from) {
+    size_t size = into.size();
+    into.insert(from.begin(), from.end());
+    return into.size() != size;
+  }
+
+  void buildSCCs();
+  void solveReturns(unsigned scc);
+  void solveParams(unsigned scc);
+  bool resolveTargets(unsigned func);
+  void resolve(const DenseSet<Value *> &set, DenseSet<Value *> &out) const;
+};
+
+// SCCs over the current targets, callees first.
+void InterprocSolver::buildSCCs() {
+  std::vector<std::vector<unsigned>> succs(funcs.size());
+  for (unsigned f = 0; f < funcs.size(); ++f) {
+    for (auto &site : funcs[f].calls) {
+      succs[f].insert(succs[f].end(), site.targets.begin(),
+                      site.targets.end());
+    }
+  }
+  sccs = findSCCs(succs, sccOf);
+}
+
+// Call results and returns of the SCC's functions until they stop growing;
+// callee SCCs are already done.
+void InterprocSolver::solveReturns(unsigned scc) {
+  bool changed = true;
+  DenseSet<Value *> set;
+  while (changed) {
+    changed = false;
+    for (unsigned f : sccs[scc]) {
+      for (auto &site : funcs[f].calls) {
+        set.clear();
+        if (site.external)
+          set.insert(site.call);
+        for (unsigned t : site.targets) {
+          for (auto *val : funcs[t].returns) {
+            auto *arg = dyn_cast<Argument>(val);
+            if (!arg || arg->getParent() != funcs[t].func) {
+              set.insert(val);
+            } else if (arg->getArgNo() < site.args.size()) {
+              expandCalls(f, site.args[arg->getArgNo()], set);
+            }
+          }
+        }
+        changed |= merge(site.results, set);
+      }
+      set.clear();
+      expandCalls(f, funcs[f].localReturns, set);
+      changed |= merge(funcs[f].returns, set);
+    }
+  }
+}
+
+// Parameters of the SCC's functions from their call sites until they stop
+// growing; caller SCCs are already done.
+void InterprocSolver::solveParams(unsigned scc) {
+  for (unsigned f : sccs[scc]) {
+    Function *func = funcs[f].func;
+    funcs[f].params.assign(func->arg_size(), {});
+    if (!calledFromOutside(*func))
+      continue;
+    for (auto &arg : func->args()) {
+      funcs[f].params[arg.getArgNo()].insert(&arg);
+    }
+  }
+  bool changed = true;
+  DenseSet<Value *> set, expanded;
+  while (changed) {
+    changed = false;
+    for (unsigned f : sccs[scc]) {
+      auto &params = funcs[f].params;
+      for (auto [caller, c] : funcs[f].callers) {
+        auto &site = funcs[caller].calls[c];
+        for (unsigned i = 0; i < params.size() && i < site.args.size(); ++i) {
+          set.clear();
+          expanded.clear();
+          expandCalls(caller, site.args[i], set);
+          expandParams(caller, set, expanded);
+          changed |= merge(params[i], expanded);
+        }
+      }
+    }
+  }
+}
+
+// Whatever placeholders are left, i.e. values of other functions read
+// through globals, resolved transitively. Casts and aggregates are looked
+// through.
+void InterprocSolver::resolve(const DenseSet<Value *> &set,
+                              DenseSet<Value *> &out) const {
+  DenseSet<Value *> visited;
+  SmallVector<Value *, 16> worklist(set.begin(), set.end());
+  while (!worklist.empty()) {
+    Value *val = worklist.pop_back_val();
+    if (!visited.insert(val).second)
+      continue;
+    const DenseSet<Value *> *solved = nullptr;
+    if (auto *arg = dyn_cast<Argument>(val)) {
+      auto it = funcIds.find(arg->getParent());
+      if (it != funcIds.end())
+        solved = &funcs[it->second].params[arg->getArgNo()];
+    } else if (auto *call = dyn_cast<CallInst>(val)) {
+      auto it = callIds.find(call);
+      if (it != callIds.end())
+        solved = &funcs[it->second.first].calls[it->second.second].results;
+    } else if (auto *expr = dyn_cast<ConstantExpr>(val)) {
+      if (expr->isCast()) {
+        worklist.push_back(expr->getOperand(0));
+        continue;
+      }
+    } else if (isa<ConstantAggregate>(val)) {
+      // field-insensitive: a table of pointers is any of them
+      for (auto &op : cast<User>(val)->operands()) {
+        worklist.push_back(op);
+      }
+      continue;
+    }
+    if (!solved) {
+      out.insert(val);
+      continue;
+    }
+    for (auto *item : *solved) {
+      if (item == val)
+        out.insert(val);
+      else
+        worklist.push_back(item);
+    }
+  }
+}
+
+// Targets of func's calls from their fully resolved callee operands; true
+// if any call got a new one.
+bool InterprocSolver::resolveTargets(unsigned func) {
+  bool grown = false;
+  DenseSet<Value *> set, expanded;
+  for (auto &site : funcs[func].calls) {
+    set.clear();
+    expanded.clear();
+    expandCalls(func, site.callee, set);
+    expandParams(func, set, expanded);
+    site.resolved.clear();
+    resolve(expanded, site.resolved);
+    site.external = site.resolved.empty();
+    for (auto *val : site.resolved) {
+      Function *target = definedFunction(val);
+      if (!target) {
+        site.external = true;
+        continue;
+      }
+      unsigned t = funcIds.lookup(target);
+      if (std::find(site.targets.begin(), site.targets.end(), t) ==
+          site.targets.end()) {
+        site.targets.push_back(t);
+        grown = true;
+      }
+    }
+  }
+  return grown;
+}
+
+// fn(i) for every i < n, strided over nthreads workers
+void parallelFor(size_t n, unsigned nthreads, const WorkerRunner &runWorkers,
+                 const std::function<void(size_t)> &fn) {
+  runWorkers(nthreads, [&](int t) {
+    for (size_t i = t; i < n; i += nthreads) {
+      fn(i);
+    }
+  });
+}
+
+std::shared_ptr<const CallSummaries>
+CallSummaries::compute(Module &module, const GlobalPoints2 *globals,
+                       unsigned nthreads, const WorkerRunner &runWorkers) {
+  InterprocSolver solver;
+  auto &funcs = solver.funcs;
+  for (auto &func : module) {
+    if (func.isDeclaration())
+      continue;
+    solver.funcIds[&func] = funcs.size();
+    funcs.push_back({&func});
+  }
+  nthreads = std::max(1u, std::min<unsigned>(nthreads, funcs.size()));
+
+  parallelFor(funcs.size(), nthreads, runWorkers, [&](size_t f) {
+    summarizeLocal(funcs[f], globals);
+    TaskArena::local().reset();
+  });
+  for (unsigned f = 0; f < funcs.size(); ++f) {
+    for (unsigned c = 0; c < funcs[f].calls.size(); ++c) {
+      auto &site = funcs[f].calls[c];
+      solver.callIds[site.call] = {f, c};
+      // direct calls, the rest is known after the first round
+      for (auto *val : site.callee) {
+        if (Function *target = definedFunction(val))
+          site.targets.push_back(solver.funcIds.lookup(target));
+        else
+          site.external = true;
+      }
+      site.external |= site.callee.empty();
+    }
+  }
+
+  auto table = std::make_shared<CallSummaries>();
+  table->module = &module;
+  bool grown = true;
+  while (grown) {
+    table->rounds++;
+    solver.buildSCCs();
+    auto &sccs = solver.sccs;
+    std::vector<std::vector<unsigned>> callees(sccs.size()),
+        callers(sccs.size());
+    for (auto &summary : funcs) {
+      summary.callers.clear();
+      summary.returns.clear();
+      for (auto &site : summary.calls) {
+        site.results.clear();
+      }
+    }
+    for (unsigned f = 0; f < funcs.size(); ++f) {
+      unsigned s = solver.sccOf[f];
+      for (unsigned c = 0; c < funcs[f].calls.size(); ++c) {
+        for (unsigned t : funcs[f].calls[c].targets) {
+          funcs[t].callers.push_back({f, c});
+          if (solver.sccOf[t] != s) {
+            callees[s].push_back(solver.sccOf[t]);
+            callers[solver.sccOf[t]].push_back(s);
+          }
+        }
+      }
+    }
+    for (auto *deps : {&callees, &callers}) {
+      for (auto &list : *deps) {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+      }
+    }
+
+    runWaves(callees, nthreads, runWorkers,
+             [&](unsigned s) { solver.solveReturns(s); });
+    runWaves(callers, nthreads, runWorkers,
+             [&](unsigned s) { solver.solveParams(s); });
+
+    std::atomic<bool> anyGrown{false};
+    parallelFor(funcs.size(), nthreads, runWorkers, [&](size_t f) {
+      if (solver.resolveTargets(f))
+        anyGrown = true;
+    });
+    grown = anyGrown;
+  }
+
+  table->sccs = solver.sccs.size();
+  for (auto &scc : solver.sccs) {
+    table->maxSCC = std::max(table->maxSCC, scc.size());
+  }
+  for (auto &summary : funcs) {
+    for (auto &site : summary.calls) {
+      table->callees[site.call] = std::move(site.resolved);
+    }
+  }
+  return table;
+}
+
+const DenseSet<Value *> *CallSummaries::lookup(const CallInst *call) const {
+  auto it = callees.find(call);
+  return it == callees.end() ? nullptr : &it->second;
+}
+
+void ZeroCFAnalysis::prepare(Module &module, unsigned nthreads,
+                             const WorkerRunner &runWorkers) {
+  globals = GlobalPoints2::compute(module, nthreads, runWorkers);
+  if (cache)
+    globalsHash = globals->hash();
+  if (mode != CFAMode::Interprocedural)
+    return;
+  summaries =
+      CallSummaries::compute(module, globals.get(), nthreads, runWorkers);
+#ifdef PRINT_STATS
+  outs() << "\t" << name() << ": " << summaries->rounds << " rounds, "
+         << summaries->sccs << " SCCs, largest " << summaries->maxSCC << "\n";
+#endif
+}
+
+void ZeroCFAnalysis::release() {
+  globals.reset();
+  summaries.reset();
+  globalsHash = 0;
+}
+
+std::string ZeroCFAnalysis::name() const {
+  switch (mode) {
+  case CFAMode::Interprocedural:
+    return "0-CFA-ipa";
+  default:
+    return "0-CFA";
+  }
+}
+
+ArrayRef<ResultKind> ZeroCFAnalysis::resultKinds() const {
+  static const ResultKind kinds[] = {ResultKind::Callees};
+  return kinds;
+}
+
 void ZeroCFAnalysis::run(Function &func) {
-  LocalData localdata;
+  // the interprocedural work is done in prepare()
+  if (summaries && summaries->getModule() == func.getParent()) {
+    if (!results || !results->covers(func))
+      return;
+    FrozenSets callees;
+    for (auto &BB : func) {
+      for (auto &inst : BB) {
+        auto *call = dyn_cast<CallInst>(&inst);
+        if (auto *targets = call ? summaries->lookup(call) : nullptr)
+          callees.add(call, *targets);
+      }
+    }
+    results->put(func, ResultKind::Callees, std::move(callees));
+    return;
+  }
+
+  CFALocalData localdata;
+  // summaries of another module (e.g. the source of a split) do not apply
+  if (globals && globals->getModule() == func.getParent())
+    localdata.globals = globals.get();
   analyzeIntra(func, localdata);
+  if (results && results->covers(func)) {
+    FrozenSets callees;
+    for (auto &[call, targets] : localdata.callMap) {
+      callees.add(call, targets);
+    }
+    results->put(func, ResultKind::Callees, std::move(callees));
+  }
 }
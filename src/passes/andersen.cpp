@@ -0,0 +1,692 @@
+#include "passes.hpp"
+#include "bitvec.hpp"
+#include "unify.hpp"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalAlias.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+// calls returning a fresh object
+const StringRef AllocFunctions[] = {
+    "malloc", "calloc", "realloc", "valloc", "aligned_alloc", "strdup",
+    "strndup", "_Znwm", "_Znam", "_ZnwmRKSt9nothrow_t", "_ZnamRKSt9nothrow_t"};
+
+bool isAllocationCall(const CallBase &call) {
+  auto *callee = call.getCalledFunction();
+  return callee && callee->isDeclaration() &&
+         is_contained(AllocFunctions, callee->getName());
+}
+
+// the global a constant address is based on, else val itself
+const Value *stripConstantAddress(const Value *val) {
+  for (;;) {
+    if (auto *alias = dyn_cast<GlobalAlias>(val)) {
+      val = alias->getAliasee();
+    } else if (auto *expr = dyn_cast<ConstantExpr>(val)) {
+      if (!expr->isCast() && expr->getOpcode() != Instruction::GetElementPtr)
+        return val;
+      val = expr->getOperand(0);
+    } else {
+      return val;
+    }
+  }
+}
+
+// Constraint graph of a module. Nodes are pointer values (arguments,
+// instructions, globals and functions as addresses), one return node per
+// defined function and one memory cell per object. Every node belongs to
+// one worker; only that worker reads or extends its constraints.
+struct AndersenGraph {
+  DenseMap<const Value *, unsigned> valueNodes;
+  DenseMap<const Function *, unsigned> returnNodes;
+  std::vector<const Value *> objects;
+  // by object: the node of its memory cell
+  std::vector<unsigned> cells;
+  // by node
+  std::vector<unsigned> owner;
+  std::vector<SparseBits> seeds;
+  // pt(t) >= pt(n) for t in copies[n]
+  std::vector<std::vector<unsigned>> copies;
+  // t = *n for t in loads[n], *n = s for s in stores[n]
+  std::vector<std::vector<unsigned>> loads, stores;
+  // calls whose callee operand is n
+  std::vector<std::vector<const CallBase *>> calls;
+
+  unsigned addNode(unsigned worker) {
+    owner.push_back(worker);
+    seeds.emplace_back();
+    copies.emplace_back();
+    loads.emplace_back();
+    stores.emplace_back();
+    calls.emplace_back();
+    return owner.size() - 1;
+  }
+  unsigned addObject(const Value *obj, unsigned worker) {
+    objects.push_back(obj);
+    cells.push_back(addNode(worker));
+    return objects.size() - 1;
+  }
+  // -1 for values without a node (null, integers, other constants)
+  int nodeOf(const Value *val) const {
+    auto it = valueNodes.find(stripConstantAddress(val));
+    return it == valueNodes.end() ? -1 : int(it->second);
+  }
+  void addCopy(const Value *from, unsigned to) {
+    int node = nodeOf(from);
+    if (node >= 0)
+      copies[node].push_back(to);
+  }
+};
+
+// Functions go to workers largest first, each to the least loaded one.
+std::vector<unsigned> partitionFunctions(const std::vector<Function *> &funcs,
+                                         unsigned nworkers) {
+  std::vector<unsigned> order(funcs.size());
+  for (unsigned i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    return funcs[a]->getInstructionCount() > funcs[b]->getInstructionCount();
+  });
+  std::vector<size_t> load(nworkers, 0);
+  std::vector<unsigned> workers(funcs.size());
+  for (unsigned i : order) {
+    unsigned least = std::min_element(load.begin(), load.end()) - load.begin();
+    workers[i] = least;
+    load[least] += funcs[i]->getInstructionCount() + 1;
+  }
+  return workers;
+}
+
+// objects of the globals and functions inside a global's initializer
+void initializerObjects(const Constant *init,
+                        const DenseMap<const Value *, unsigned> &objectIds,
+                        SparseBits &objs) {
+  SmallPtrSet<const Constant *, 16> visited;
+  std::vector<const Constant *> stack = {init};
+  while (!stack.empty()) {
+    const Constant *constant = stack.back();
+    stack.pop_back();
+    if (!visited.insert(constant).second)
+      continue;
+    if (isa<GlobalValue>(constant)) {
+      auto it = objectIds.find(stripConstantAddress(constant));
+      if (it != objectIds.end())
+        objs.set(it->second);
+      continue;
+    }
+    for (auto &op : constant->operands()) {
+      if (auto *operand = dyn_cast<Constant>(op))
+        stack.push_back(operand);
+    }
+  }
+}
+
+void buildAndersenGraph(Module &module, unsigned nworkers,
+                        AndersenGraph &graph) {
+  DenseMap<const Value *, unsigned> objectIds;
+  unsigned next = 0;
+  for (auto &global : module.global_values()) {
+    if (!isa<GlobalVariable>(global) && !isa<Function>(global))
+      continue;
+    unsigned worker = next++ % nworkers;
+    unsigned node = graph.addNode(worker);
+    graph.valueNodes[&global] = node;
+    objectIds[&global] = graph.addObject(&global, worker);
+    graph.seeds[node].set(objectIds[&global]);
+  }
+
+  std::vector<Function *> funcs;
+  for (auto &func : module) {
+    if (!func.isDeclaration())
+      funcs.push_back(&func);
+  }
+  auto workers = partitionFunctions(funcs, nworkers);
+  for (unsigned i = 0; i < funcs.size(); ++i) {
+    Function &func = *funcs[i];
+    unsigned worker = workers[i];
+    for (auto &arg : func.args()) {
+      if (arg.getType()->isPointerTy())
+        graph.valueNodes[&arg] = graph.addNode(worker);
+    }
+    if (func.getReturnType()->isPointerTy())
+      graph.returnNodes[&func] = graph.addNode(worker);
+    for (auto &BB : func) {
+      for (auto &inst : BB) {
+        if (!inst.getType()->isPointerTy())
+          continue;
+        unsigned node = graph.addNode(worker);
+        graph.valueNodes[&inst] = node;
+        auto *call = dyn_cast<CallBase>(&inst);
+        if (isa<AllocaInst>(inst) || (call && isAllocationCall(*call))) {
+          // addObject() grows seeds, so take the id before indexing it
+          unsigned obj = graph.addObject(&inst, worker);
+          graph.seeds[node].set(obj);
+        }
+      }
+    }
+  }
+
+  for (auto &global : module.globals()) {
+    if (global.hasInitializer())
+      initializerObjects(global.getInitializer(), objectIds,
+                         graph.seeds[graph.cells[objectIds[&global]]]);
+  }
+  for (auto *func : funcs) {
+    for (auto &BB : *func) {
+      for (auto &inst : BB) {
+        auto it = graph.valueNodes.find(&inst);
+        int node = it == graph.valueNodes.end() ? -1 : int(it->second);
+        if (auto *phi = dyn_cast<PHINode>(&inst)) {
+          if (node >= 0) {
+            for (auto &incoming : phi->incoming_values()) {
+              graph.addCopy(incoming, node);
+            }
+          }
+        } else if (auto *select = dyn_cast<SelectInst>(&inst)) {
+          if (node >= 0) {
+            graph.addCopy(select->getTrueValue(), node);
+            graph.addCopy(select->getFalseValue(), node);
+          }
+        } else if (isa<CastInst>(inst) || isa<GetElementPtrInst>(inst)) {
+          // field-insensitive: a field address is its base's
+          if (node >= 0)
+            graph.addCopy(inst.getOperand(0), node);
+        } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
+          int ptr = graph.nodeOf(load->getPointerOperand());
+          if (node >= 0 && ptr >= 0)
+            graph.loads[ptr].push_back(node);
+        } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+          int ptr = graph.nodeOf(store->getPointerOperand());
+          int val = graph.nodeOf(store->getValueOperand());
+          if (ptr >= 0 && val >= 0)
+            graph.stores[ptr].push_back(val);
+        } else if (auto *ret = dyn_cast<ReturnInst>(&inst)) {
+          auto it = graph.returnNodes.find(func);
+          if (ret->getReturnValue() && it != graph.returnNodes.end())
+            graph.addCopy(ret->getReturnValue(), it->second);
+        } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+          // direct calls too: the callee's address node holds the callee
+          int callee = graph.nodeOf(call->getCalledOperand());
+          if (callee >= 0)
+            graph.calls[callee].push_back(call);
+        }
+      }
+    }
+  }
+}
+
+struct EdgeMessage {
+  unsigned src, dst;
+};
+
+struct DeltaMessage {
+  unsigned node;
+  SparseBits bits;
+};
+
+struct Mailbox {
+  std::vector<EdgeMessage> edges;
+  std::vector<DeltaMessage> deltas;
+};
+
+// Workers own disjoint node partitions and run rounds. In a round a worker
+// applies the messages sent to it in the last one, then solves its own
+// nodes to a local fixpoint; constraints reaching another worker's node
+// become messages for the next round. Only the barrier between rounds
+// synchronizes, and the solve ends after a round without messages.
+struct AndersenSolver {
+  const AndersenGraph &graph;
+  unsigned nworkers;
+  // by node, each touched only by its owner
+  std::vector<SparseBits> pt, pending;
+  std::vector<std::vector<unsigned>> copies;
+  // [parity][from * nworkers + to]: written by from in rounds of that
+  // parity, drained by to in the next round
+  std::vector<Mailbox> mail[2];
+
+  std::mutex lock;
+  std::condition_variable cv;
+  unsigned arrived = 0;
+  size_t roundMessages = 0;
+  bool finished = false;
+  size_t rounds = 0, messages = 0, edges = 0;
+
+  AndersenSolver(const AndersenGraph &graph, unsigned nworkers)
+      : graph(graph), nworkers(nworkers), pt(graph.owner.size()),
+        pending(graph.owner.size()), copies(graph.copies) {
+    mail[0].resize(nworkers * nworkers);
+    mail[1].resize(nworkers * nworkers);
+  }
+  // barrier: true once a whole round sent no messages
+  bool endRound(size_t sent, size_t added);
+  void solve();
+};
+
+struct AndersenWorker {
+  AndersenSolver &solver;
+  const AndersenGraph &graph;
+  unsigned id;
+  unsigned parity = 0;
+  std::vector<unsigned> worklist;
+  DenseSet<uint64_t> edgeSet;
+  // this round's outgoing delta per remote node
+  DenseMap<unsigned, unsigned> outDeltas;
+  size_t sent = 0, added = 0;
+
+  AndersenWorker(AndersenSolver &solver, unsigned id)
+      : solver(solver), graph(solver.graph), id(id) {}
+
+  Mailbox &outbox(unsigned to) {
+    return solver.mail[parity][id * solver.nworkers + to];
+  }
+
+  void send(unsigned t, const SparseBits &bits) {
+    if (graph.owner[t] != id) {
+      auto &deltas = outbox(graph.owner[t]).deltas;
+      auto [it, inserted] = outDeltas.try_emplace(t, deltas.size());
+      if (inserted) {
+        deltas.push_back({t, bits});
+        ++sent;
+      } else {
+        deltas[it->second].bits.unionWith(bits);
+      }
+      return;
+    }
+    bool idle = solver.pending[t].empty();
+    if (solver.pending[t].unionWith(bits, &solver.pt[t]) && idle)
+      worklist.push_back(t);
+  }
+
+  void addEdge(unsigned s, unsigned t) {
+    if (graph.owner[s] != id) {
+      outbox(graph.owner[s]).edges.push_back({s, t});
+      ++sent;
+      return;
+    }
+    if (!edgeSet.insert(uint64_t(s) << 32 | t).second)
+      return;
+    solver.copies[s].push_back(t);
+    ++added;
+    if (!solver.pt[s].empty())
+      send(t, solver.pt[s]);
+  }
+
+  void bindCall(const CallBase &call, const Function &callee) {
+    if (callee.isDeclaration())
+      return;
+    unsigned nargs = std::min<unsigned>(call.arg_size(), callee.arg_size());
+    for (unsigned i = 0; i < nargs; ++i) {
+      auto param = graph.valueNodes.find(callee.getArg(i));
+      int arg = graph.nodeOf(call.getArgOperand(i));
+      if (param != graph.valueNodes.end() && arg >= 0)
+        addEdge(arg, param->second);
+    }
+    auto ret = graph.returnNodes.find(&callee);
+    auto result = graph.valueNodes.find(&call);
+    if (ret != graph.returnNodes.end() && result != graph.valueNodes.end())
+      addEdge(ret->second, result->second);
+  }
+
+  void process(unsigned n) {
+    SparseBits delta;
+    delta.swap(solver.pending[n]);
+    solver.pt[n].unionWith(delta);
+    // edges added below already carry all of pt(n)
+    size_t ncopies = solver.copies[n].size();
+    for (size_t i = 0; i < ncopies; ++i) {
+      send(solver.copies[n][i], delta);
+    }
+    if (graph.loads[n].empty() && graph.stores[n].empty() &&
+        graph.calls[n].empty())
+      return;
+    delta.forEach([&](size_t obj) {
+      unsigned cell = graph.cells[obj];
+      for (unsigned t : graph.loads[n]) {
+        addEdge(cell, t);
+      }
+      for (unsigned s : graph.stores[n]) {
+        addEdge(s, cell);
+      }
+      if (auto *callee = dyn_cast<Function>(graph.objects[obj])) {
+        for (auto *call : graph.calls[n]) {
+          bindCall(*call, *callee);
+        }
+      }
+    });
+  }
+
+  void run() {
+    for (unsigned n = 0; n < graph.owner.size(); ++n) {
+      if (graph.owner[n] != id)
+        continue;
+      for (unsigned t : graph.copies[n]) {
+        edgeSet.insert(uint64_t(n) << 32 | t);
+      }
+      if (!graph.seeds[n].empty())
+        send(n, graph.seeds[n]);
+    }
+    for (;;) {
+      for (unsigned from = 0; from < solver.nworkers; ++from) {
+        Mailbox &inbox = solver.mail[parity ^ 1][from * solver.nworkers + id];
+        for (auto &edge : inbox.edges) {
+          addEdge(edge.src, edge.dst);
+        }
+        for (auto &delta : inbox.deltas) {
+          send(delta.node, delta.bits);
+        }
+        inbox.edges.clear();
+        inbox.deltas.clear();
+      }
+      while (!worklist.empty()) {
+        unsigned n = worklist.back();
+        worklist.pop_back();
+        process(n);
+      }
+      if (solver.endRound(sent, added))
+        return;
+      sent = 0;
+      added = 0;
+      outDeltas.clear();
+      parity ^= 1;
+    }
+  }
+};
+
+bool AndersenSolver::endRound(size_t sent, size_t added) {
+  std::unique_lock<std::mutex> guard(lock);
+  roundMessages += sent;
+  edges += added;
+  if (++arrived == nworkers) {
+    finished = roundMessages == 0;
+    messages += roundMessages;
+    roundMessages = 0;
+    arrived = 0;
+    ++rounds;
+    cv.notify_all();
+    return finished;
+  }
+  size_t round = rounds;
+  cv.wait(guard, [&] { return rounds != round; });
+  return finished;
+}
+
+void AndersenSolver::solve() {
+  for (auto &targets : graph.copies) {
+    edges += targets.size();
+  }
+  std::vector<std::thread> threads;
+  for (unsigned w = 1; w < nworkers; ++w) {
+    threads.emplace_back([this, w] { AndersenWorker(*this, w).run(); });
+  }
+  AndersenWorker(*this, 0).run();
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+std::shared_ptr<const ModulePoints2> ModulePoints2::compute(Module &module,
+                                                            unsigned nthreads) {
+  size_t defined = 0;
+  for (auto &func : module) {
+    defined += !func.isDeclaration();
+  }
+  unsigned nworkers =
+      std::max<unsigned>(1, std::min<size_t>(nthreads, defined));
+  AndersenGraph graph;
+  buildAndersenGraph(module, nworkers, graph);
+  AndersenSolver solver(graph, nworkers);
+  solver.solve();
+
+  auto table = std::make_shared<ModulePoints2>();
+  table->module = &module;
+  table->objects = graph.objects;
+  table->rounds = solver.rounds;
+  table->nodes = graph.owner.size();
+  table->edges = solver.edges;
+  table->messages = solver.messages;
+  for (auto &[val, node] : graph.valueNodes) {
+    if (solver.pt[node].empty())
+      continue;
+    table->setIds[val] = table->sets.size();
+    auto &set = table->sets.emplace_back();
+    solver.pt[node].forEach([&](size_t obj) { set.push_back(obj); });
+  }
+  return table;
+}
+
+using CallBinding = std::pair<const CallBase *, const Function *>;
+
+// Binds the calls whose callee class holds a function not yet bound to
+// them; false once there are none left.
+bool unifyCalls(const AndersenGraph &graph, PointeeClasses &classes,
+                DenseSet<CallBinding> &bound) {
+  DenseMap<unsigned, std::vector<const Function *>> funcsOf;
+  for (unsigned obj = 0; obj < graph.objects.size(); ++obj) {
+    if (auto *func = dyn_cast<Function>(graph.objects[obj]))
+      if (!func->isDeclaration())
+        funcsOf[classes.find(graph.cells[obj])].push_back(func);
+  }
+  bool changed = false;
+  for (unsigned n = 0; n < graph.calls.size(); ++n) {
+    int target = graph.calls[n].empty() ? -1 : classes.pointeeClass(n);
+    auto it = target < 0 ? funcsOf.end() : funcsOf.find(target);
+    if (it == funcsOf.end())
+      continue;
+    for (auto *callee : it->second) {
+      for (auto *call : graph.calls[n]) {
+        if (!bound.insert({call, callee}).second)
+          continue;
+        changed = true;
+        unsigned nargs =
+            std::min<unsigned>(call->arg_size(), callee->arg_size());
+        for (unsigned i = 0; i < nargs; ++i) {
+          auto param = graph.valueNodes.find(callee->getArg(i));
+          int arg = graph.nodeOf(call->getArgOperand(i));
+          if (param != graph.valueNodes.end() && arg >= 0)
+            classes.join(classes.pointeeOf(param->second),
+                         classes.pointeeOf(arg));
+        }
+        auto ret = graph.returnNodes.find(callee);
+        auto result = graph.valueNodes.find(call);
+        if (ret != graph.returnNodes.end() &&
+            result != graph.valueNodes.end())
+          classes.join(classes.pointeeOf(result->second),
+                       classes.pointeeOf(ret->second));
+      }
+    }
+  }
+  return changed;
+}
+
+std::shared_ptr<const ModulePoints2> ModulePoints2::unify(Module &module) {
+  AndersenGraph graph;
+  buildAndersenGraph(module, 1, graph);
+  PointeeClasses classes(graph.owner.size());
+  for (unsigned n = 0; n < graph.owner.size(); ++n) {
+    graph.seeds[n].forEach([&](size_t obj) {
+      classes.join(classes.pointeeOf(n), graph.cells[obj]);
+    });
+    for (unsigned t : graph.copies[n]) {
+      classes.join(classes.pointeeOf(t), classes.pointeeOf(n));
+    }
+    for (unsigned t : graph.loads[n]) {
+      classes.join(classes.pointeeOf(t),
+                   classes.pointeeOf(classes.pointeeOf(n)));
+    }
+    for (unsigned v : graph.stores[n]) {
+      classes.join(classes.pointeeOf(classes.pointeeOf(n)),
+                   classes.pointeeOf(v));
+    }
+  }
+  // every round of bindings may put more functions into callee classes
+  DenseSet<CallBinding> bound;
+  size_t rounds = 1;
+  while (unifyCalls(graph, classes, bound)) {
+    ++rounds;
+  }
+
+  auto table = std::make_shared<ModulePoints2>();
+  table->module = &module;
+  table->objects = graph.objects;
+  table->rounds = rounds;
+  table->nodes = graph.owner.size();
+  table->edges = classes.joins;
+  DenseMap<unsigned, unsigned> classSets;
+  for (unsigned obj = 0; obj < graph.objects.size(); ++obj) {
+    auto [it, inserted] = classSets.try_emplace(
+        classes.find(graph.cells[obj]), table->sets.size());
+    if (inserted)
+      table->sets.emplace_back();
+    table->sets[it->second].push_back(obj);
+  }
+  for (auto &[val, node] : graph.valueNodes) {
+    int target = classes.pointeeClass(node);
+    auto it = target < 0 ? classSets.end() : classSets.find(target);
+    if (it != classSets.end())
+      table->setIds[val] = it->second;
+  }
+  return table;
+}
+
+ArrayRef<unsigned> ModulePoints2::lookup(const Value *val) const {
+  auto it = setIds.find(stripConstantAddress(val));
+  if (it == setIds.end())
+    return {};
+  return sets[it->second];
+}
+
+void ModulePoints2::pointsTo(const Value *val,
+                             std::vector<const Value *> &objs) const {
+  for (unsigned obj : lookup(val)) {
+    objs.push_back(objects[obj]);
+  }
+}
+
+bool ModulePoints2::mayAlias(const Value *a, const Value *b) const {
+  auto x = lookup(a), y = lookup(b);
+  for (size_t i = 0, k = 0; i < x.size() && k < y.size();) {
+    if (x[i] == y[k])
+      return true;
+    if (x[i] < y[k])
+      ++i;
+    else
+      ++k;
+  }
+  return false;
+}
+
+size_t ModulePoints2::totalSize() const {
+  size_t total = 0;
+  for (auto &[val, set] : setIds) {
+    total += sets[set].size();
+  }
+  return total;
+}
+
+bool ModulePoints2::operator==(const ModulePoints2 &other) const {
+  if (objects != other.objects || setIds.size() != other.setIds.size())
+    return false;
+  for (auto &[val, set] : setIds) {
+    if (lookup(val) != other.lookup(val))
+      return false;
+  }
+  return true;
+}
+
+bool ModulePoints2::includes(const ModulePoints2 &other) const {
+  if (objects != other.objects)
+    return false;
+  for (auto &[val, set] : other.setIds) {
+    auto mine = lookup(val);
+    for (unsigned obj : other.sets[set]) {
+      if (!std::binary_search(mine.begin(), mine.end(), obj))
+        return false;
+    }
+  }
+  return true;
+}
+
+void storeModulePoints2(Module &module, const ModulePoints2 &solution,
+                        ResultStore &results) {
+  std::vector<const Value *> objs;
+  for (auto &func : module) {
+    if (func.isDeclaration() || !results.covers(func))
+      continue;
+    FrozenSets sets;
+    auto add = [&](const Value &val) {
+      objs.clear();
+      solution.pointsTo(&val, objs);
+      if (!objs.empty())
+        sets.add(&val, objs);
+    };
+    for (auto &arg : func.args()) {
+      add(arg);
+    }
+    for (auto &BB : func) {
+      for (auto &inst : BB) {
+        add(inst);
+      }
+    }
+    results.put(func, ResultKind::ModulePoints2, std::move(sets));
+  }
+}
+
+std::string ModulePoints2Analysis::name() const {
+  switch (engine) {
+  case ModulePoints2Engine::Unification:
+    return "steensgaard";
+  default:
+    return "andersen";
+  }
+}
+
+ArrayRef<ResultKind> ModulePoints2Analysis::resultKinds() const {
+  static const ResultKind kinds[] = {ResultKind::ModulePoints2};
+  return kinds;
+}
+
+void ModulePoints2Analysis::run(Module &module) {
+  switch (engine) {
+  case ModulePoints2Engine::Unification:
+    solution = ModulePoints2::unify(module);
+#ifdef VERIFY_PASSES
+    if (!solution->includes(*ModulePoints2::compute(module, nthreads)))
+      errs() << name() << ": misses inclusion sets\n";
+#endif
+    break;
+  default:
+    solution = ModulePoints2::compute(module, nthreads);
+#ifdef VERIFY_PASSES
+    if (nthreads > 1 && !(*ModulePoints2::compute(module, 1) == *solution))
+      errs() << name() << ": " << nthreads
+             << " workers disagree with one worker\n";
+#endif
+    break;
+  }
+#ifdef PRINT_STATS
+  outs() << "\t" << name() << ": " << solution->rounds << " rounds, "
+         << solution->nodes << " nodes, " << solution->edges
+         << (engine == ModulePoints2Engine::Unification ? " joins, "
+                                                         : " edges, ")
+         << solution->messages << " messages, " << solution->totalSize()
+         << " points-to pairs\n";
+#endif
+  if (results)
+    storeModulePoints2(module, *solution, *results);
+}
@@ -0,0 +1,62 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+constexpr size_t MinChunk = size_t(64) << 10;
+constexpr size_t MaxRetained = size_t(64) << 20;
+
+TaskArena &TaskArena::local() {
+  static thread_local TaskArena arena;
+  return arena;
+}
+
+TaskArena::~TaskArena() {
+  for (auto &chunk : chunks) {
+    std::free(chunk.data);
+  }
+}
+
+void *TaskArena::do_allocate(size_t size, size_t align) {
+  allocs++;
+  bytes += size;
+  while (true) {
+    if (ptr) {
+      auto addr = reinterpret_cast<uintptr_t>(ptr);
+      char *aligned = ptr + ((align - addr % align) % align);
+      if (aligned <= end && size <= size_t(end - aligned)) {
+        ptr = aligned + size;
+        return aligned;
+      }
+    }
+    if (ptr && current + 1 < chunks.size()) {
+      ++current;
+    } else {
+      // first chunk, or all kept chunks used up: grow geometrically
+      size_t last = chunks.empty() ? 0 : chunks.back().size;
+      size_t chunkSize = std::max({MinChunk, 2 * last, size + align});
+      char *data = static_cast<char *>(std::malloc(chunkSize));
+      if (!data)
+        std::abort();
+      chunks.push_back({data, chunkSize});
+      retained += chunkSize;
+      current = chunks.size() - 1;
+    }
+    ptr = chunks[current].data;
+    end = ptr + chunks[current].size;
+  }
+}
+
+void TaskArena::reset() {
+  while (retained > MaxRetained && chunks.size() > 1) {
+    retained -= chunks.back().size;
+    std::free(chunks.back().data);
+    chunks.pop_back();
+  }
+  current = 0;
+  ptr = chunks.empty() ? nullptr : chunks[0].data;
+  end = chunks.empty() ? nullptr : ptr + chunks[0].size;
+  allocs = 0;
+  bytes = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Monotonic memory for the containers a pass builds while it runs on one
+// function. Every thread has its own arena; allocations bump a pointer
+// through chunks that are kept from task to task, deallocation does nothing
+// and reset() rewinds to the first chunk. Nothing allocated from it may
+// outlive the task.
+class TaskArena : public std::pmr::memory_resource {
+private:
+  struct Chunk {
+    char *data;
+    size_t size;
+  };
+  std::vector<Chunk> chunks;
+  size_t current = 0;
+  char *ptr = nullptr;
+  char *end = nullptr;
+  size_t retained = 0;
+
+  size_t allocs = 0;
+  size_t bytes = 0;
+
+  void *do_allocate(size_t size, size_t align) override;
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  TaskArena() = default;
+  ~TaskArena();
+  TaskArena(const TaskArena &) = delete;
+  TaskArena &operator=(const TaskArena &) = delete;
+
+  // this thread's arena
+  static TaskArena &local();
+
+  // Chunks past MaxRetained bytes are returned to malloc here, so one
+  // huge function does not pin its memory for the rest of the run.
+  void reset();
+
+  // since the last reset
+  size_t allocations() const { return allocs; }
+  size_t allocatedBytes() const { return bytes; }
+  size_t chunkCount() const { return chunks.size(); }
+};
+
+inline std::pmr::memory_resource *taskArena() { return &TaskArena::local(); }
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Word-packed bit sets living in caller-owned flat arrays. A set over N
+// elements occupies bitWords(N) consecutive words; many sets of the same
+// universe are usually laid out back to back in one std::vector. The bulk
+// operations are plain word loops without early exits so that the compiler
+// can vectorize them.
+
+using BitWord = uint64_t;
+constexpr size_t BitsPerWord = 64;
+
+inline size_t bitWords(size_t nbits) {
+  return (nbits + BitsPerWord - 1) / BitsPerWord;
+}
+
+inline void bitSet(BitWord *bits, size_t i) {
+  bits[i / BitsPerWord] |= BitWord(1) << (i % BitsPerWord);
+}
+
+inline bool bitTest(const BitWord *bits, size_t i) {
+  return (bits[i / BitsPerWord] >> (i % BitsPerWord)) & 1;
+}
+
+// dst = src
+inline void bitCopy(BitWord *dst, const BitWord *src, size_t nwords) {
+  for (size_t i = 0; i < nwords; ++i)
+    dst[i] = src[i];
+}
+
+// dst |= src
+inline void bitOr(BitWord *dst, const BitWord *src, size_t nwords) {
+  for (size_t i = 0; i < nwords; ++i)
+    dst[i] |= src[i];
+}
+
+// dst |= a \ b
+inline void bitOrDiff(BitWord *dst, const BitWord *a, const BitWord *b,
+                      size_t nwords) {
+  for (size_t i = 0; i < nwords; ++i)
+    dst[i] |= a[i] & ~b[i];
+}
+
+// dst = src, returns whether dst changed
+inline bool bitAssign(BitWord *dst, const BitWord *src, size_t nwords) {
+  BitWord diff = 0;
+  for (size_t i = 0; i < nwords; ++i) {
+    diff |= dst[i] ^ src[i];
+    dst[i] = src[i];
+  }
+  return diff != 0;
+}
+
+inline size_t bitCount(const BitWord *bits, size_t nwords) {
+  size_t count = 0;
+  for (size_t i = 0; i < nwords; ++i)
+    count += __builtin_popcountll(bits[i]);
+  return count;
+}
+
+template <typename Fn>
+inline void bitForEach(const BitWord *bits, size_t nwords, Fn fn) {
+  for (size_t w = 0; w < nwords; ++w) {
+    BitWord word = bits[w];
+    while (word) {
+      fn(w * BitsPerWord + __builtin_ctzll(word));
+      word &= word - 1;
+    }
+  }
+}
+
+// Sparse bit set over the same word layout: only the non-zero words are
+// kept, with their word index, sorted by index. Unions merge into a
+// per-thread scratch buffer that is swapped in afterwards, so steady-state
+// updates do not allocate.
+class SparseBits {
+private:
+  struct Entry {
+    uint32_t index;
+    BitWord bits;
+  };
+  std::vector<Entry> entries;
+
+  static std::vector<Entry> &scratch() {
+    static thread_local std::vector<Entry> merged;
+    return merged;
+  }
+
+public:
+  bool empty() const { return entries.empty(); }
+  void clear() { entries.clear(); }
+  void swap(SparseBits &other) { entries.swap(other.entries); }
+  bool operator==(const SparseBits &rhs) const {
+    if (entries.size() != rhs.entries.size())
+      return false;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].index != rhs.entries[i].index ||
+          entries[i].bits != rhs.entries[i].bits)
+        return false;
+    }
+    return true;
+  }
+
+  size_t count() const {
+    size_t count = 0;
+    for (auto &entry : entries)
+      count += __builtin_popcountll(entry.bits);
+    return count;
+  }
+
+  bool test(size_t i) const {
+    uint32_t index = i / BitsPerWord;
+    auto it = std::lower_bound(
+        entries.begin(), entries.end(), index,
+        [](const Entry &entry, uint32_t index) { return entry.index < index; });
+    return it != entries.end() && it->index == index &&
+           ((it->bits >> (i % BitsPerWord)) & 1);
+  }
+
+  void set(size_t i) {
+    SparseBits single;
+    single.entries.push_back(
+        {uint32_t(i / BitsPerWord), BitWord(1) << (i % BitsPerWord)});
+    unionWith(single);
+  }
+
+  // this |= other \ mask (mask may be null), returns whether this changed
+  bool unionWith(const SparseBits &other, const SparseBits *mask = nullptr) {
+    if (other.entries.empty())
+      return false;
+    auto &merged = scratch();
+    merged.clear();
+    merged.reserve(entries.size() + other.entries.size());
+    bool changed = false;
+    size_t i = 0, k = 0;
+    for (Entry add : other.entries) {
+      if (mask) {
+        while (k < mask->entries.size() && mask->entries[k].index < add.index)
+          ++k;
+        if (k < mask->entries.size() && mask->entries[k].index == add.index)
+          add.bits &= ~mask->entries[k].bits;
+        if (!add.bits)
+          continue;
+      }
+      while (i < entries.size() && entries[i].index < add.index)
+        merged.push_back(entries[i++]);
+      if (i < entries.size() && entries[i].index == add.index) {
+        BitWord bits = entries[i].bits | add.bits;
+        changed |= bits != entries[i].bits;
+        merged.push_back({add.index, bits});
+        ++i;
+      } else {
+        merged.push_back(add);
+        changed = true;
+      }
+    }
+    if (!changed)
+      return false;
+    merged.insert(merged.end(), entries.begin() + i, entries.end());
+    entries.swap(merged);
+    return true;
+  }
+
+  // this \= mask
+  void subtract(const SparseBits &mask) {
+    size_t out = 0, k = 0;
+    for (Entry entry : entries) {
+      while (k < mask.entries.size() && mask.entries[k].index < entry.index)
+        ++k;
+      if (k < mask.entries.size() && mask.entries[k].index == entry.index)
+        entry.bits &= ~mask.entries[k].bits;
+      if (entry.bits)
+        entries[out++] = entry;
+    }
+    entries.resize(out);
+  }
+
+  // this &= other
+  void intersectWith(const SparseBits &other) {
+    size_t out = 0, k = 0;
+    for (Entry entry : entries) {
+      while (k < other.entries.size() && other.entries[k].index < entry.index)
+        ++k;
+      if (k < other.entries.size() && other.entries[k].index == entry.index)
+        entry.bits &= other.entries[k].bits;
+      else
+        entry.bits = 0;
+      if (entry.bits)
+        entries[out++] = entry;
+    }
+    entries.resize(out);
+  }
+
+  template <typename Fn> void forEach(Fn fn) const {
+    for (auto &entry : entries) {
+      BitWord word = entry.bits;
+      while (word) {
+        fn(size_t(entry.index) * BitsPerWord + __builtin_ctzll(word));
+        word &= word - 1;
+      }
+    }
+  }
+};
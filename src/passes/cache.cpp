@@ -0,0 +1,501 @@
+#include "cache.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace llvm;
+
+// bump when the hash or the entry layout changes
+constexpr uint32_t CacheFormatVersion = 1;
+constexpr uint32_t CacheMagic = 0x45434d50; // "PMCE"
+// instruction index of a constant entry that names a global's initializer
+constexpr uint32_t InitializerOf = ~0u;
+
+uint64_t hashWords(ArrayRef<uint64_t> words) {
+  return xxHash64(makeArrayRef(reinterpret_cast<const uint8_t *>(words.data()),
+                               words.size() * sizeof(uint64_t)));
+}
+
+void numberLocals(const Function &func,
+                  DenseMap<const Value *, unsigned> &ids) {
+  for (auto &arg : func.args()) {
+    ids[&arg] = ids.size();
+  }
+  for (auto &BB : func) {
+    ids[&BB] = ids.size();
+  }
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      ids[&inst] = ids.size();
+    }
+  }
+}
+
+struct StructuralHasher {
+  SmallVector<uint64_t, 512> words;
+  DenseMap<const Value *, unsigned> ids;
+
+  void add(uint64_t word) { words.push_back(word); }
+  void add(StringRef str) { words.push_back(xxHash64(str)); }
+  void add(const APInt &value) {
+    add(value.getBitWidth());
+    for (unsigned w = 0; w < value.getNumWords(); ++w) {
+      add(value.getRawData()[w]);
+    }
+  }
+
+  void type(Type *ty) {
+    add(ty->getTypeID());
+    if (auto *intTy = dyn_cast<IntegerType>(ty)) {
+      add(intTy->getBitWidth());
+    } else if (auto *ptrTy = dyn_cast<PointerType>(ty)) {
+      add(ptrTy->getAddressSpace());
+      if (!ptrTy->isOpaque())
+        type(ptrTy->getNonOpaquePointerElementType());
+    } else if (auto *structTy = dyn_cast<StructType>(ty)) {
+      // named structs by name, which also ends recursive types
+      if (structTy->hasName()) {
+        add(structTy->getName());
+        return;
+      }
+      add(structTy->getNumElements());
+      for (auto *elem : structTy->elements()) {
+        type(elem);
+      }
+    } else {
+      add(ty->getNumContainedTypes());
+      if (auto *arrayTy = dyn_cast<ArrayType>(ty))
+        add(arrayTy->getNumElements());
+      else if (auto *vecTy = dyn_cast<VectorType>(ty))
+        add(vecTy->getElementCount().getKnownMinValue());
+      for (auto *contained : ty->subtypes()) {
+        type(contained);
+      }
+    }
+  }
+
+  void operand(const Value *val) {
+    auto it = ids.find(val);
+    if (it != ids.end()) {
+      add(1);
+      add(it->second);
+    } else if (auto *global = dyn_cast<GlobalValue>(val)) {
+      add(2);
+      add(global->getName());
+      type(global->getType());
+    } else if (auto *constInt = dyn_cast<ConstantInt>(val)) {
+      add(3);
+      type(constInt->getType());
+      add(constInt->getValue());
+    } else if (auto *constFP = dyn_cast<ConstantFP>(val)) {
+      add(4);
+      type(constFP->getType());
+      add(constFP->getValueAPF().bitcastToAPInt());
+    } else if (auto *expr = dyn_cast<ConstantExpr>(val)) {
+      add(5);
+      add(expr->getOpcode());
+      type(expr->getType());
+      if (expr->isCompare())
+        add(expr->getPredicate());
+      if (auto *gep = dyn_cast<GEPOperator>(expr))
+        type(gep->getSourceElementType());
+      for (auto &op : expr->operands()) {
+        operand(op);
+      }
+    } else if (auto *data = dyn_cast<ConstantDataSequential>(val)) {
+      add(6);
+      type(data->getType());
+      add(data->getRawDataValues());
+    } else if (auto *constant = dyn_cast<Constant>(val)) {
+      add(7);
+      add(constant->getValueID());
+      type(constant->getType());
+      add(constant->getNumOperands());
+      for (auto &op : constant->operands()) {
+        operand(op);
+      }
+    } else if (auto *asmVal = dyn_cast<InlineAsm>(val)) {
+      add(8);
+      add(asmVal->getAsmString());
+      add(asmVal->getConstraintString());
+    } else {
+      // metadata arguments and the like
+      add(9);
+      add(val->getValueID());
+    }
+  }
+
+  void instruction(const Instruction &inst) {
+    add(inst.getOpcode());
+    type(inst.getType());
+    add(inst.getNumOperands());
+    for (auto &op : inst.operands()) {
+      operand(op);
+    }
+    if (auto *cmp = dyn_cast<CmpInst>(&inst)) {
+      add(cmp->getPredicate());
+    } else if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
+      type(alloca->getAllocatedType());
+    } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+      type(gep->getSourceElementType());
+    } else if (auto *phi = dyn_cast<PHINode>(&inst)) {
+      for (auto *BB : phi->blocks()) {
+        add(ids.lookup(BB));
+      }
+    } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+      type(call->getFunctionType());
+    } else if (auto *extract = dyn_cast<ExtractValueInst>(&inst)) {
+      for (unsigned idx : extract->indices()) {
+        add(idx);
+      }
+    } else if (auto *insert = dyn_cast<InsertValueInst>(&inst)) {
+      for (unsigned idx : insert->indices()) {
+        add(idx);
+      }
+    } else if (auto *shuffle = dyn_cast<ShuffleVectorInst>(&inst)) {
+      for (int elt : shuffle->getShuffleMask()) {
+        add(elt);
+      }
+    }
+  }
+};
+
+uint64_t structuralHash(const Function &func) {
+  StructuralHasher hasher;
+  numberLocals(func, hasher.ids);
+  hasher.type(func.getFunctionType());
+  for (auto &BB : func) {
+    hasher.add(BB.size());
+    for (auto &inst : BB) {
+      hasher.instruction(inst);
+    }
+  }
+  return hashWords(hasher.words);
+}
+
+uint64_t StableValueHasher::hash(const Value *val) {
+  const Function *func = nullptr;
+  if (auto *arg = dyn_cast<Argument>(val))
+    func = arg->getParent();
+  else if (auto *inst = dyn_cast<Instruction>(val))
+    func = inst->getFunction();
+  else if (auto *BB = dyn_cast<BasicBlock>(val))
+    func = BB->getParent();
+  if (func) {
+    auto &ids = positions[func];
+    if (ids.empty())
+      numberLocals(*func, ids);
+    uint64_t words[] = {1, xxHash64(func->getName()), ids.lookup(val)};
+    return hashWords(words);
+  }
+  StructuralHasher hasher;
+  hasher.operand(val);
+  return hashWords(hasher.words);
+}
+
+AnalysisCache::AnalysisCache(std::string dir) : dir(std::move(dir)) {}
+
+bool AnalysisCache::init() {
+  if (std::error_code EC = sys::fs::create_directories(dir)) {
+    errs() << "Cannot create cache directory " << dir << ": " << EC.message()
+           << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::string AnalysisCache::path(uint64_t key) const {
+  std::string name;
+  raw_string_ostream os(name);
+  os << dir << "/" << format_hex_no_prefix(key, 16) << ".res";
+  return os.str();
+}
+
+uint64_t AnalysisCache::key(const Function &func, StringRef pass,
+                            unsigned version, uint64_t context) {
+  uint64_t words[] = {CacheFormatVersion, structuralHash(func), xxHash64(pass),
+                      version, context};
+  return hashWords(words);
+}
+
+// Entry layout, all fields native-endian:
+//   u32 magic, u32 format version, u64 key, u64 run time in ns,
+//   u32 has results,
+//   u32 globals, per global u32 length and the name,
+//   u32 constants, per constant u32 instruction and u32 operand, or
+//     InitializerOf and u32 global,
+//   u32 kinds, per kind u32 kind and u32 sets, per set u32 key ref,
+//   u32 size and size refs.
+// A ref below the function's local count is a local position, the next
+// ones are the globals, then the constants.
+struct EntryReader {
+  const char *ptr, *end;
+  bool ok = true;
+
+  template <typename T> T read() {
+    T value{};
+    if (size_t(end - ptr) < sizeof(T)) {
+      ok = false;
+      return value;
+    }
+    std::memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return value;
+  }
+  StringRef readString(uint32_t size) {
+    if (size_t(end - ptr) < size) {
+      ok = false;
+      return {};
+    }
+    StringRef str(ptr, size);
+    ptr += size;
+    return str;
+  }
+};
+
+bool AnalysisCache::load(uint64_t key, const Function &func,
+                         ResultStore *results, ArrayRef<ResultKind> kinds) {
+  std::ifstream file(path(key), std::ios::binary);
+  if (!file) {
+    missCount++;
+    return false;
+  }
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  EntryReader in{data.data(), data.data() + data.size()};
+  bool wantResults = results && results->covers(func) && !kinds.empty();
+  if (in.read<uint32_t>() != CacheMagic ||
+      in.read<uint32_t>() != CacheFormatVersion || in.read<uint64_t>() != key) {
+    missCount++;
+    return false;
+  }
+  uint64_t nanos = in.read<uint64_t>();
+  bool hasResults = in.read<uint32_t>();
+  if (!in.ok || (wantResults && !hasResults)) {
+    missCount++;
+    return false;
+  }
+  if (!wantResults) {
+    hitCount++;
+    savedNanos += nanos;
+    return true;
+  }
+
+  DenseMap<const Value *, unsigned> ids;
+  numberLocals(func, ids);
+  std::vector<const Value *> values(ids.size());
+  for (auto &[val, id] : ids) {
+    values[id] = val;
+  }
+  size_t nlocals = values.size();
+  uint32_t nglobals = in.read<uint32_t>();
+  for (uint32_t g = 0; g < nglobals && in.ok; ++g) {
+    StringRef name = in.readString(in.read<uint32_t>());
+    const Value *global = func.getParent()->getNamedValue(name);
+    in.ok &= global != nullptr;
+    values.push_back(global);
+  }
+  uint32_t nconsts = in.read<uint32_t>();
+  for (uint32_t c = 0; c < nconsts && in.ok; ++c) {
+    uint32_t inst = in.read<uint32_t>(), op = in.read<uint32_t>();
+    if (inst == InitializerOf) {
+      auto *global = op < nglobals
+                         ? dyn_cast<GlobalVariable>(values[nlocals + op])
+                         : nullptr;
+      in.ok &= global && global->hasInitializer();
+      values.push_back(in.ok ? global->getInitializer() : nullptr);
+      continue;
+    }
+    auto *user = inst < nlocals ? dyn_cast<Instruction>(values[inst]) : nullptr;
+    in.ok &= user && op < user->getNumOperands();
+    values.push_back(in.ok ? user->getOperand(op) : nullptr);
+  }
+
+  std::vector<std::pair<ResultKind, FrozenSets>> loaded;
+  std::vector<const Value *> set;
+  uint32_t nkinds = in.read<uint32_t>();
+  for (uint32_t k = 0; k < nkinds && in.ok; ++k) {
+    ResultKind kind = ResultKind(in.read<uint32_t>());
+    FrozenSets sets;
+    uint32_t nsets = in.read<uint32_t>();
+    for (uint32_t s = 0; s < nsets && in.ok; ++s) {
+      uint32_t keyRef = in.read<uint32_t>();
+      uint32_t size = in.read<uint32_t>();
+      set.clear();
+      for (uint32_t i = 0; i < size && in.ok; ++i) {
+        uint32_t ref = in.read<uint32_t>();
+        in.ok &= ref < values.size();
+        if (in.ok)
+          set.push_back(values[ref]);
+      }
+      in.ok &= keyRef < values.size();
+      if (in.ok)
+        sets.add(values[keyRef], set);
+    }
+    loaded.push_back({kind, std::move(sets)});
+  }
+  if (!in.ok || loaded.size() != kinds.size()) {
+    missCount++;
+    return false;
+  }
+  for (auto &[kind, sets] : loaded) {
+    results->put(func, kind, std::move(sets));
+  }
+  hitCount++;
+  savedNanos += nanos;
+  return true;
+}
+
+struct EntryWriter {
+  std::string data;
+
+  template <typename T> void write(T value) {
+    data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+};
+
+// Refs of the values in a function's result sets. Globals and constants
+// are collected in a first pass, so their refs are known once the counts
+// are.
+struct EntryRefs {
+  const Function &func;
+  DenseMap<const Value *, unsigned> ids;
+  std::vector<StringRef> globals;
+  std::vector<std::pair<uint32_t, uint32_t>> consts;
+  DenseMap<const Value *, unsigned> globalIds, constIds;
+  DenseMap<const Value *, std::pair<uint32_t, uint32_t>> operandAt;
+  bool ok = true;
+
+  explicit EntryRefs(const Function &func) : func(func) {
+    numberLocals(func, ids);
+  }
+
+  void collect(const Value *val) {
+    if (ids.count(val) || globalIds.count(val) || constIds.count(val))
+      return;
+    if (auto *global = dyn_cast<GlobalValue>(val)) {
+      ok &= global->hasName();
+      globalIds[val] = globals.size();
+      globals.push_back(global->getName());
+      return;
+    }
+    // other constants by their first use as an operand here
+    if (isa<Constant>(val) && operandAt.empty()) {
+      for (auto &BB : func) {
+        for (auto &inst : BB) {
+          for (auto &op : inst.operands()) {
+            if (isa<Constant>(op) && !operandAt.count(op))
+              operandAt[op] = {ids.lookup(&inst), op.getOperandNo()};
+          }
+        }
+      }
+    }
+    auto at = operandAt.find(val);
+    if (at != operandAt.end()) {
+      constIds[val] = consts.size();
+      consts.push_back(at->second);
+      return;
+    }
+    // or as a global's initializer, which 0-CFA follows
+    for (auto &global : func.getParent()->globals()) {
+      if (global.hasInitializer() && global.getInitializer() == val) {
+        collect(&global);
+        constIds[val] = consts.size();
+        consts.push_back({InitializerOf, globalIds.lookup(&global)});
+        return;
+      }
+    }
+    ok = false;
+  }
+
+  uint32_t ref(const Value *val) const {
+    auto it = ids.find(val);
+    if (it != ids.end())
+      return it->second;
+    it = globalIds.find(val);
+    if (it != globalIds.end())
+      return ids.size() + it->second;
+    return ids.size() + globals.size() + constIds.lookup(val);
+  }
+};
+
+void AnalysisCache::store(uint64_t key, const Function &func,
+                          const ResultStore *results,
+                          ArrayRef<ResultKind> kinds, long nanos) {
+  bool hasResults = results && results->covers(func) && !kinds.empty();
+  EntryWriter out;
+  out.write(CacheMagic);
+  out.write(CacheFormatVersion);
+  out.write(key);
+  out.write(uint64_t(nanos));
+  out.write(uint32_t(hasResults));
+
+  if (hasResults) {
+    EntryRefs refs(func);
+    for (ResultKind kind : kinds) {
+      if (auto *frozen = results->get(func, kind)) {
+        frozen->forEach([&](const Value *keyVal, ArrayRef<const Value *> set) {
+          refs.collect(keyVal);
+          for (auto *val : set) {
+            refs.collect(val);
+          }
+        });
+      }
+    }
+    if (!refs.ok)
+      return;
+
+    out.write(uint32_t(refs.globals.size()));
+    for (StringRef name : refs.globals) {
+      out.write(uint32_t(name.size()));
+      out.data.append(name.data(), name.size());
+    }
+    out.write(uint32_t(refs.consts.size()));
+    for (auto &[inst, op] : refs.consts) {
+      out.write(inst);
+      out.write(op);
+    }
+    out.write(uint32_t(kinds.size()));
+    for (ResultKind kind : kinds) {
+      const FrozenSets *frozen = results->get(func, kind);
+      out.write(uint32_t(kind));
+      out.write(uint32_t(frozen ? frozen->size() : 0));
+      if (!frozen)
+        continue;
+      frozen->forEach([&](const Value *keyVal, ArrayRef<const Value *> set) {
+        out.write(refs.ref(keyVal));
+        out.write(uint32_t(set.size()));
+        for (auto *val : set) {
+          out.write(refs.ref(val));
+        }
+      });
+    }
+  }
+
+  static std::atomic<unsigned> tmpCount{0};
+  std::string target = path(key);
+  std::string tmp = target + ".tmp" + std::to_string(tmpCount++) + "." +
+                    std::to_string(sys::Process::getProcessId());
+  {
+    std::ofstream file(tmp, std::ios::binary);
+    file.write(out.data.data(), out.data.size());
+    if (!file)
+      return;
+  }
+  if (std::rename(tmp.c_str(), target.c_str()) != 0)
+    std::remove(tmp.c_str());
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "results.hpp"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Hash of a function body that is the same in every run and every module
+// the body appears in: types, opcodes, operands by position, referenced
+// globals by name. Bodies with equal hashes number their arguments, blocks
+// and instructions the same way.
+uint64_t structuralHash(const llvm::Function &func);
+
+// Every function-local value gets its position: arguments, then blocks,
+// then instructions in block order.
+void numberLocals(const llvm::Function &func,
+                  llvm::DenseMap<const llvm::Value *, unsigned> &ids);
+
+// Hash of where a value sits in its module, stable across runs: globals by
+// name, locals by function name and position.
+class StableValueHasher {
+private:
+  llvm::DenseMap<const llvm::Function *,
+                 llvm::DenseMap<const llvm::Value *, unsigned>>
+      positions;
+
+public:
+  uint64_t hash(const llvm::Value *val);
+};
+
+// Results of earlier runs on disk, one file per (function body, pass,
+// version, context) key under dir. A task whose key is present is skipped;
+// the stored sets go into the pass's ResultStore if it has one. Entries
+// written without a store only satisfy runs without one. Files are written
+// under a temporary name and renamed, so concurrent writers and readers
+// never see a partial entry.
+class AnalysisCache {
+private:
+  std::string dir;
+  std::atomic<size_t> hitCount{0}, missCount{0};
+  std::atomic<long> savedNanos{0};
+
+  std::string path(uint64_t key) const;
+
+public:
+  explicit AnalysisCache(std::string dir);
+  // false if dir cannot be created
+  bool init();
+
+  static uint64_t key(const llvm::Function &func, llvm::StringRef pass,
+                      unsigned version, uint64_t context);
+
+  // On a hit, the stored sets of kinds go into results when it covers func.
+  bool load(uint64_t key, const llvm::Function &func, ResultStore *results,
+            llvm::ArrayRef<ResultKind> kinds);
+  // The sets of kinds results holds for func, or none without a store.
+  // Entries with values the format cannot name (locals of other
+  // functions) are not written.
+  void store(uint64_t key, const llvm::Function &func,
+             const ResultStore *results, llvm::ArrayRef<ResultKind> kinds,
+             long nanos);
+
+  size_t hits() const { return hitCount; }
+  size_t misses() const { return missCount; }
+  // run time the hits recorded when they were computed
+  long savedMicros() const { return savedNanos / 1000; }
+  void resetStats() {
+    hitCount = 0;
+    missCount = 0;
+    savedNanos = 0;
+  }
+};
@@ -0,0 +1,161 @@
+#include "counters.hpp"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+std::atomic<bool> PerfCounters::on{false};
+
+struct CounterEvent {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+static const CounterEvent HardwareEvents[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static const CounterEvent SoftwareEvents[] = {
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+int openCounter(const CounterEvent &event, int group) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.disabled = group == -1;
+  // user-space only for hardware events, so perf_event_paranoid=2 is enough;
+  // faults and switches happen in the kernel
+  attr.exclude_kernel = event.type == PERF_TYPE_HARDWARE;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Leader first, members that fail to open are left out; empty when not
+// even the leader opens.
+std::vector<const CounterEvent *> openGroup(const CounterEvent *begin,
+                                            const CounterEvent *end,
+                                            std::vector<int> &fds) {
+  std::vector<const CounterEvent *> opened;
+  for (const CounterEvent *event = begin; event != end; ++event) {
+    int fd = openCounter(*event, fds.empty() ? -1 : fds[0]);
+    if (fd < 0) {
+      if (fds.empty())
+        return opened;
+      continue;
+    }
+    fds.push_back(fd);
+    opened.push_back(event);
+  }
+  return opened;
+}
+
+struct CounterProbe {
+  CounterMode mode = CounterMode::None;
+  std::vector<const CounterEvent *> events;
+  std::vector<std::string> names;
+};
+
+const CounterProbe &counterProbe() {
+  static const CounterProbe probe = [] {
+    CounterProbe probe;
+    std::vector<int> fds;
+    probe.events = openGroup(std::begin(HardwareEvents),
+                             std::end(HardwareEvents), fds);
+    probe.mode = CounterMode::Hardware;
+    if (probe.events.empty()) {
+      probe.events = openGroup(std::begin(SoftwareEvents),
+                               std::end(SoftwareEvents), fds);
+      probe.mode = CounterMode::Software;
+    }
+    if (probe.events.empty())
+      probe.mode = CounterMode::None;
+    for (int fd : fds) {
+      close(fd);
+    }
+    for (auto *event : probe.events) {
+      probe.names.push_back(event->name);
+    }
+    return probe;
+  }();
+  return probe;
+}
+
+CounterMode PerfCounters::mode() { return counterProbe().mode; }
+
+const char *PerfCounters::modeName() {
+  switch (mode()) {
+  case CounterMode::Hardware:
+    return "hardware";
+  case CounterMode::Software:
+    return "software";
+  default:
+    return "none";
+  }
+}
+
+const std::vector<std::string> &PerfCounters::names() {
+  return counterProbe().names;
+}
+
+PerfCounters::PerfCounters() {
+  for (auto *event : counterProbe().events) {
+    int fd = openCounter(*event, fds.empty() ? -1 : fds[0]);
+    if (fd < 0) {
+      // a group missing a member would misnumber the values
+      for (int open : fds) {
+        close(open);
+      }
+      fds.clear();
+      return;
+    }
+    fds.push_back(fd);
+  }
+  if (fds.empty())
+    return;
+  leader = fds[0];
+  ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+PerfCounters &PerfCounters::local() {
+  static thread_local PerfCounters counters;
+  return counters;
+}
+
+bool PerfCounters::read(CounterValues &values) const {
+  if (leader < 0)
+    return false;
+  // nr, time enabled, time running, then one value per event
+  uint64_t buffer[3 + MaxCounters];
+  ssize_t size = ::read(leader, buffer, sizeof(buffer));
+  if (size < ssize_t(3 * sizeof(uint64_t)) || buffer[0] != fds.size())
+    return false;
+  uint64_t enabled = buffer[1], running = buffer[2];
+  for (size_t i = 0; i < fds.size(); ++i) {
+    uint64_t value = buffer[3 + i];
+    values[i] = running && running < enabled
+                    ? uint64_t(double(value) * enabled / running)
+                    : value;
+  }
+  return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Running totals of the counters PerfCounters opened, in names() order.
+constexpr size_t MaxCounters = 4;
+using CounterValues = std::array<uint64_t, MaxCounters>;
+
+enum class CounterMode { None, Hardware, Software };
+
+// Linux perf_event_open counters of the calling thread: cycles,
+// instructions, cache misses and branch misses when the CPU and kernel
+// expose them, otherwise task-clock (ns), page faults and context switches.
+// Every thread opens its own event group on first use and reads it with one
+// read(2); totals are scaled for multiplexing. Nothing is opened or read
+// unless enabled.
+class PerfCounters {
+private:
+  static std::atomic<bool> on;
+  int leader = -1;
+  std::vector<int> fds;
+
+  PerfCounters();
+
+public:
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  static bool enabled() { return on.load(std::memory_order_relaxed); }
+  static void enable() { on.store(true); }
+  static void disable() { on.store(false); }
+
+  // Probed once per process, the same for every thread.
+  static CounterMode mode();
+  static const char *modeName();
+  static const std::vector<std::string> &names();
+
+  // this thread's counters
+  static PerfCounters &local();
+
+  // false, leaving values alone, when this thread has no counters
+  bool read(CounterValues &values) const;
+};
@@ -1,20 +1,34 @@
 #include "passes.hpp"
+#include "bitvec.hpp"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
 #include <cstdlib>
+#include <deque>
+#include <memory_resource>
 #include <queue>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace llvm;
 
+// pass-local sets of the Set engine live in the task arena
+using ValueSet = std::pmr::set<Value *>;
+using BlockSets = std::pmr::unordered_map<BasicBlock *, ValueSet>;
+
 // std::set<BasicBlock *> findExitBBs(Function &func) {
 //   std::set<BasicBlock *> exitBBs;
 //   for (auto &BB : func) {
@@ -29,11 +43,8 @@ using namespace llvm;
 // PhiDefs(B) the variables defined by φ-functions at the entry of block B
 // PhiUses(B) the set of variables used in a φ-function at the entry of a
 // successor of the block B
-void findUSEsDEFs(
-    Function &func, std::unordered_map<BasicBlock *, std::set<Value *>> &USEs,
-    std::unordered_map<BasicBlock *, std::set<Value *>> &DEFs,
-    std::unordered_map<BasicBlock *, std::set<Value *>> &phiUSEs,
-    std::unordered_map<BasicBlock *, std::set<Value *>> &phiDEFs) {
+void findUSEsDEFs(Function &func, BlockSets &USEs, BlockSets &DEFs,
+                  BlockSets &phiUSEs, BlockSets &phiDEFs) {
   for (auto &BB : func) {
     auto &DEF = DEFs[&BB];
     auto &USE = USEs[&BB];
@@ -76,18 +87,18 @@ void findUSEsDEFs(
   }
 }
 
-void findLiveVars(Function &func,
-                  std::unordered_map<BasicBlock *, std::set<Value *>> &INs,
-                  std::unordered_map<BasicBlock *, std::set<Value *>> &OUTs) {
+// returns the number of block visits
+size_t findLiveVars(Function &func, BlockSets &INs, BlockSets &OUTs) {
   if (func.isDeclaration())
-    return;
+    return 0;
 
-  std::unordered_map<BasicBlock *, std::set<Value *>> USEs, DEFs, phiUSEs,
-      phiDEFs;
+  BlockSets USEs(taskArena()), DEFs(taskArena()), phiUSEs(taskArena()),
+      phiDEFs(taskArena());
   std::set<BasicBlock *> sideBBs;
   findUSEsDEFs(func, USEs, DEFs, phiUSEs, phiDEFs);
-  std::queue<BasicBlock *> worklist;
-  std::unordered_set<BasicBlock *> hashWL;
+  std::queue<BasicBlock *, std::pmr::deque<BasicBlock *>> worklist(
+      taskArena());
+  std::pmr::unordered_set<BasicBlock *> hashWL(taskArena());
   // auto exitBBs = findExitBBs(func);
   // for (BasicBlock *eBB : exitBBs) {
   //   if (hashWL.insert(eBB).second)
@@ -104,16 +115,18 @@ void findLiveVars(Function &func,
   }
 
   // std::unordered_map<BasicBlock *, std::set<Value *>> INs, OUTs;
+  size_t visits = 0;
   while (!worklist.empty()) {
     BasicBlock *BB = worklist.front();
     worklist.pop();
     hashWL.erase(BB);
+    visits++;
 
     // LiveOut(B) = ⋃_S∈succs(B) (LiveIn(S) \ PhiDefs(S)) ∪ PhiUses(B)
     // LiveIn(B) = PhiDefs(B) ∪ UpwardExposed(B) ∪ (LiveOut(B) \ Defs(B))
     // std::set<Value *> oldIN = INs[BB], oldOUT = OUTs[BB];
     bool changed = false;
-    std::set<Value *> liveIN, liveOUT;
+    ValueSet liveIN(taskArena()), liveOUT(taskArena());
     liveOUT = phiUSEs[BB];
     for (BasicBlock *succ : successors(BB)) {
       std::set_difference(INs[succ].begin(), INs[succ].end(),
@@ -137,9 +150,885 @@ void findLiveVars(Function &func,
       }
     }
   }
+  return visits;
 }
 
-void LivenessAnalysis::run(Function &func) {
-  std::unordered_map<BasicBlock *, std::set<Value *>> INs, OUTs;
+// Dense variant of the above. Values that can be live across a block
+// boundary get ids 0..nvals-1, blocks get ids in function order, and every
+// per-block set is a row of nwords words in one flat array indexed by block
+// id.
+struct DenseLiveness {
+  std::vector<Value *> values;
+  DenseMap<Value *, unsigned> valueIds;
+  std::vector<BasicBlock *> blocks;
+  DenseMap<BasicBlock *, unsigned> blockIds;
+  // CSR successor/predecessor lists over block ids
+  std::vector<unsigned> succBegin, succs, predBegin, preds;
+  size_t nwords = 0;
+  std::vector<BitWord> USEs, DEFs, phiUSEs, phiDEFs, INs, OUTs;
+  // the blocks in RPOT, i.e. the reachable ones
+  std::vector<unsigned> order;
+  std::vector<char> reachable;
+  size_t visits = 0;
+  bool irreducible = false;
+
+  BitWord *row(std::vector<BitWord> &sets, unsigned b) {
+    return sets.data() + b * nwords;
+  }
+};
+
+// A value that is only used later in its own block never reaches any
+// USE/phiUSE/phiDEF set, so leaving it out keeps the rows short. In reachable
+// blocks dominance guarantees that non-phi users in the defining block come
+// after the definition; unreachable blocks keep everything.
+bool mayLiveAcross(Instruction &inst) {
+  if (isa<PHINode>(inst))
+    return true;
+  for (User *user : inst.users()) {
+    auto *userInst = dyn_cast<Instruction>(user);
+    if (!userInst)
+      continue;
+    if (isa<PHINode>(userInst) || userInst->getParent() != inst.getParent())
+      return true;
+  }
+  return false;
+}
+
+void numberFunc(Function &func, ReversePostOrderTraversal<Function *> &RPOT,
+                DenseLiveness &live) {
+  DenseSet<BasicBlock *> reachable(RPOT.begin(), RPOT.end());
+  for (auto &arg : func.args()) {
+    if (arg.use_empty())
+      continue;
+    live.valueIds[&arg] = live.values.size();
+    live.values.push_back(&arg);
+  }
+  for (auto &BB : func) {
+    live.blockIds[&BB] = live.blocks.size();
+    live.blocks.push_back(&BB);
+    for (auto &inst : BB) {
+      if (inst.getType()->isVoidTy())
+        continue;
+      if (reachable.count(&BB) && !mayLiveAcross(inst))
+        continue;
+      live.valueIds[&inst] = live.values.size();
+      live.values.push_back(&inst);
+    }
+  }
+
+  unsigned nblocks = live.blocks.size();
+  live.reachable.assign(nblocks, 0);
+  for (BasicBlock *BB : RPOT) {
+    unsigned b = live.blockIds[BB];
+    live.order.push_back(b);
+    live.reachable[b] = 1;
+  }
+  live.succBegin.reserve(nblocks + 1);
+  live.predBegin.reserve(nblocks + 1);
+  for (BasicBlock *BB : live.blocks) {
+    live.succBegin.push_back(live.succs.size());
+    for (BasicBlock *succ : successors(BB))
+      live.succs.push_back(live.blockIds[succ]);
+    live.predBegin.push_back(live.preds.size());
+    for (BasicBlock *pred : predecessors(BB))
+      live.preds.push_back(live.blockIds[pred]);
+  }
+  live.succBegin.push_back(live.succs.size());
+  live.predBegin.push_back(live.preds.size());
+
+  live.nwords = bitWords(live.values.size());
+  size_t total = nblocks * live.nwords;
+  for (auto *sets : {&live.USEs, &live.DEFs, &live.phiUSEs, &live.phiDEFs,
+                     &live.INs, &live.OUTs})
+    sets->assign(total, 0);
+}
+
+void findUSEsDEFsDense(DenseLiveness &live) {
+  for (unsigned b = 0; b < live.blocks.size(); ++b) {
+    BasicBlock &BB = *live.blocks[b];
+    BitWord *DEF = live.row(live.DEFs, b);
+    BitWord *USE = live.row(live.USEs, b);
+    BitWord *pDEF = live.row(live.phiDEFs, b);
+
+    auto iter = BB.begin();
+    for (; iter != BB.end(); ++iter) {
+      auto *phi = dyn_cast<PHINode>(&*iter);
+      if (!phi)
+        break;
+      bitSet(pDEF, live.valueIds[phi]);
+      for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+        Value *inVal = phi->getIncomingValue(i);
+        if (!isa<Instruction>(inVal) && !isa<Argument>(inVal))
+          continue;
+        unsigned inBB = live.blockIds[phi->getIncomingBlock(i)];
+        bitSet(live.row(live.phiUSEs, inBB), live.valueIds[inVal]);
+      }
+    }
+
+    for (; iter != BB.end(); ++iter) {
+      auto &inst = *iter;
+      for (auto &oprand : inst.operands()) {
+        Value *val = oprand.get();
+        if (!isa<Instruction>(val) && !isa<Argument>(val))
+          continue;
+        auto id = live.valueIds.find(val);
+        if (id != live.valueIds.end() && !bitTest(DEF, id->second))
+          bitSet(USE, id->second);
+      }
+      auto id = live.valueIds.find(&inst);
+      if (id != live.valueIds.end())
+        bitSet(DEF, id->second);
+    }
+  }
+}
+
+// Iterates from seeds until nothing changes, on words [lo, hi) of every
+// row; every value's sets only depend on its own bits. With reachableOnly
+// unreachable blocks are left for solveUnreachableDense(). Returns the
+// number of block visits.
+size_t solveLiveVarsDense(DenseLiveness &live, ArrayRef<unsigned> seeds,
+                          size_t lo, size_t hi, bool reachableOnly = false) {
+  size_t nwords = hi - lo;
+  std::queue<unsigned> worklist;
+  std::vector<char> inWL(live.blocks.size(), 0);
+  for (unsigned b : seeds) {
+    if (!inWL[b]) {
+      inWL[b] = 1;
+      worklist.push(b);
+    }
+  }
+
+  auto row = [&](std::vector<BitWord> &sets, unsigned b) {
+    return live.row(sets, b) + lo;
+  };
+  std::vector<BitWord> scratch(nwords);
+  BitWord *tmp = scratch.data();
+  size_t visits = 0;
+  while (!worklist.empty()) {
+    unsigned b = worklist.front();
+    worklist.pop();
+    inWL[b] = 0;
+    visits++;
+
+    // LiveOut(B) = ⋃_S∈succs(B) (LiveIn(S) \ PhiDefs(S)) ∪ PhiUses(B)
+    // LiveIn(B) = PhiDefs(B) ∪ UpwardExposed(B) ∪ (LiveOut(B) \ Defs(B))
+    bool changed = false;
+    bitCopy(tmp, row(live.phiUSEs, b), nwords);
+    for (unsigned i = live.succBegin[b]; i < live.succBegin[b + 1]; ++i) {
+      unsigned succ = live.succs[i];
+      bitOrDiff(tmp, row(live.INs, succ), row(live.phiDEFs, succ), nwords);
+    }
+    BitWord *OUT = row(live.OUTs, b);
+    changed |= bitAssign(OUT, tmp, nwords);
+
+    bitCopy(tmp, row(live.phiDEFs, b), nwords);
+    bitOrDiff(tmp, OUT, row(live.DEFs, b), nwords);
+    bitOr(tmp, row(live.USEs, b), nwords);
+    changed |= bitAssign(row(live.INs, b), tmp, nwords);
+
+    if (changed) {
+      for (unsigned i = live.predBegin[b]; i < live.predBegin[b + 1]; ++i) {
+        unsigned pred = live.preds[i];
+        if (!inWL[pred] && (!reachableOnly || live.reachable[pred])) {
+          inWL[pred] = 1;
+          worklist.push(pred);
+        }
+      }
+    }
+  }
+  return visits;
+}
+
+// The worklist reaches an unreachable block through a successor whose sets
+// are not empty, in any word; solves those blocks once every reachable one
+// is done.
+size_t solveUnreachableDense(DenseLiveness &live) {
+  if (live.order.size() == live.blocks.size())
+    return 0;
+  std::vector<unsigned> seeds;
+  for (unsigned b : live.order) {
+    if (!bitCount(live.row(live.INs, b), live.nwords) &&
+        !bitCount(live.row(live.OUTs, b), live.nwords))
+      continue;
+    for (unsigned i = live.predBegin[b]; i < live.predBegin[b + 1]; ++i) {
+      if (!live.reachable[live.preds[i]])
+        seeds.push_back(live.preds[i]);
+    }
+  }
+  return solveLiveVarsDense(live, seeds, 0, live.nwords);
+}
+
+void prepareLiveVarsDense(Function &func, DenseLiveness &live) {
+  ReversePostOrderTraversal<Function *> RPOT(&func);
+  numberFunc(func, RPOT, live);
+  findUSEsDEFsDense(live);
+}
+
+void findLiveVarsDense(Function &func, DenseLiveness &live) {
+  if (func.isDeclaration())
+    return;
+
+  prepareLiveVarsDense(func, live);
+  live.visits += solveLiveVarsDense(live, live.order, 0, live.nwords);
+}
+
+// The loop nesting forest of a CFG from one DFS (Wei et al.): every
+// block's innermost loop header, -1 outside of loops, and the reachable
+// blocks in postorder. Blocks on the DFS path have pos > 0. An edge into a
+// loop whose header is not on the path enters it away from the header, so
+// the CFG is irreducible; the search stops there.
+struct LoopForest {
+  std::vector<int> header;
+  std::vector<char> isHeader;
+  std::vector<unsigned> pos, postorder, postIds;
+  // by header, its row of values live around the loop
+  std::vector<int> loopRows;
+  unsigned nloops = 0;
+  bool irreducible = false;
+};
+
+void tagLoopHeader(LoopForest &forest, unsigned b, int h) {
+  if (h < 0 || int(b) == h)
+    return;
+  // keep every header chain ordered by DFS path position, innermost first
+  int cur1 = b, cur2 = h;
+  while (forest.header[cur1] >= 0) {
+    int ih = forest.header[cur1];
+    if (ih == cur2)
+      return;
+    if (forest.pos[ih] < forest.pos[cur2]) {
+      forest.header[cur1] = cur2;
+      cur1 = cur2;
+      cur2 = ih;
+    } else {
+      cur1 = ih;
+    }
+  }
+  forest.header[cur1] = cur2;
+}
+
+void findLoopForest(DenseLiveness &live, unsigned entry, LoopForest &forest) {
+  unsigned nblocks = live.blocks.size();
+  forest.header.assign(nblocks, -1);
+  forest.isHeader.assign(nblocks, 0);
+  forest.pos.assign(nblocks, 0);
+  forest.postIds.assign(nblocks, nblocks);
+  std::vector<char> visited(nblocks, 0);
+  std::vector<std::pair<unsigned, unsigned>> stack; // block, next succ
+  auto visit = [&](unsigned b) {
+    visited[b] = 1;
+    forest.pos[b] = stack.size() + 1;
+    stack.push_back({b, live.succBegin[b]});
+  };
+  visit(entry);
+  while (!stack.empty()) {
+    auto &[b, next] = stack.back();
+    if (next == live.succBegin[b + 1]) {
+      unsigned done = b;
+      forest.pos[done] = 0;
+      forest.postIds[done] = forest.postorder.size();
+      forest.postorder.push_back(done);
+      stack.pop_back();
+      if (!stack.empty())
+        tagLoopHeader(forest, stack.back().first, forest.header[done]);
+      continue;
+    }
+    unsigned succ = live.succs[next++];
+    if (!visited[succ]) {
+      // visit() grows stack
+      visit(succ);
+    } else if (forest.pos[succ] > 0) {
+      forest.isHeader[succ] = 1;
+      tagLoopHeader(forest, b, succ);
+    } else if (forest.header[succ] >= 0) {
+      int h = forest.header[succ];
+      if (forest.pos[h] == 0) {
+        forest.irreducible = true;
+        return;
+      }
+      tagLoopHeader(forest, b, h);
+    }
+  }
+
+  forest.loopRows.assign(nblocks, -1);
+  for (unsigned b : forest.postorder) {
+    if (forest.isHeader[b])
+      forest.loopRows[b] = forest.nloops++;
+  }
+}
+
+// Non-iterative liveness (Brandner et al.) on words [lo, hi) of the dense
+// sets of a reducible CFG. One post-order pass over the CFG without loop
+// back edges finds everything but the values live around loops. Those are
+// live-in at the loop header and not its phis, and one pass down the loop
+// nesting forest makes them live in every block of the loop. Returns the
+// number of block visits.
+size_t solveLiveVarsLoops(DenseLiveness &live, LoopForest &forest, size_t lo,
+                          size_t hi) {
+  size_t nwords = hi - lo;
+  auto row = [&](std::vector<BitWord> &sets, unsigned b) {
+    return live.row(sets, b) + lo;
+  };
+  size_t visits = 0;
+
+  // the edges left are those to blocks finished earlier
+  auto &post = forest.postIds;
+  for (unsigned b : forest.postorder) {
+    visits++;
+    BitWord *OUT = row(live.OUTs, b);
+    bitCopy(OUT, row(live.phiUSEs, b), nwords);
+    for (unsigned i = live.succBegin[b]; i < live.succBegin[b + 1]; ++i) {
+      unsigned succ = live.succs[i];
+      if (post[succ] < post[b])
+        bitOrDiff(OUT, row(live.INs, succ), row(live.phiDEFs, succ), nwords);
+    }
+    BitWord *IN = row(live.INs, b);
+    bitCopy(IN, row(live.phiDEFs, b), nwords);
+    bitOrDiff(IN, OUT, row(live.DEFs, b), nwords);
+    bitOr(IN, row(live.USEs, b), nwords);
+  }
+
+  // Headers come before their loops in reverse postorder, so a block only
+  // takes what is live around its innermost loop, which already holds what
+  // is live around the loops enclosing it.
+  std::vector<BitWord> liveLoops(forest.nloops * nwords, 0);
+  for (unsigned b : reverse(forest.postorder)) {
+    BitWord *IN = row(live.INs, b), *OUT = row(live.OUTs, b);
+    if (int h = forest.header[b]; h >= 0) {
+      visits++;
+      BitWord *liveLoop = liveLoops.data() + forest.loopRows[h] * nwords;
+      bitOr(IN, liveLoop, nwords);
+      bitOr(OUT, liveLoop, nwords);
+    }
+    if (forest.loopRows[b] >= 0) {
+      BitWord *liveLoop = liveLoops.data() + forest.loopRows[b] * nwords;
+      bitOrDiff(liveLoop, IN, row(live.phiDEFs, b), nwords);
+      bitOr(OUT, liveLoop, nwords);
+    }
+  }
+  return visits;
+}
+
+// solveLiveVarsLoops on the whole rows, or the worklist on irreducible CFGs
+void findLiveVarsLoops(Function &func, DenseLiveness &live) {
+  if (func.isDeclaration())
+    return;
+
+  prepareLiveVarsDense(func, live);
+  LoopForest forest;
+  findLoopForest(live, live.blockIds[&func.getEntryBlock()], forest);
+  if (forest.irreducible) {
+    live.irreducible = true;
+    live.visits += solveLiveVarsDense(live, live.order, 0, live.nwords);
+    return;
+  }
+  live.visits += solveLiveVarsLoops(live, forest, 0, live.nwords);
+  live.visits += solveUnreachableDense(live);
+}
+
+#ifdef VERIFY_PASSES
+bool sameLiveSets(DenseLiveness &live, BlockSets &sets,
+                  std::vector<BitWord> &rows) {
+  for (unsigned b = 0; b < live.blocks.size(); ++b) {
+    auto &expected = sets[live.blocks[b]];
+    BitWord *bits = live.row(rows, b);
+    if (bitCount(bits, live.nwords) != expected.size())
+      return false;
+    for (Value *val : expected) {
+      auto id = live.valueIds.find(val);
+      if (id == live.valueIds.end() || !bitTest(bits, id->second))
+        return false;
+    }
+  }
+  return true;
+}
+
+void verifyLiveVarsDense(Function &func, DenseLiveness &live,
+                         StringRef pass) {
+  BlockSets INs(taskArena()), OUTs(taskArena());
   findLiveVars(func, INs, OUTs);
+  if (!sameLiveSets(live, INs, live.INs) ||
+      !sameLiveSets(live, OUTs, live.OUTs)) {
+    errs() << pass << ": mismatch in " << func.getName() << "\n";
+  }
+}
+#endif
+
+void storeLiveSets(Function &func, ResultStore &results, BlockSets &INs,
+                   BlockSets &OUTs) {
+  FrozenSets liveIn, liveOut;
+  for (auto &BB : func) {
+    liveIn.add(&BB, INs[&BB]);
+    liveOut.add(&BB, OUTs[&BB]);
+  }
+  results.put(func, ResultKind::LiveIn, std::move(liveIn));
+  results.put(func, ResultKind::LiveOut, std::move(liveOut));
+}
+
+void storeLiveSetsDense(Function &func, ResultStore &results,
+                        DenseLiveness &live) {
+  FrozenSets liveIn, liveOut;
+  std::vector<Value *> set;
+  auto add = [&](FrozenSets &sets, std::vector<BitWord> &rows, unsigned b) {
+    set.clear();
+    bitForEach(live.row(rows, b), live.nwords,
+               [&](size_t v) { set.push_back(live.values[v]); });
+    sets.add(live.blocks[b], set);
+  };
+  for (unsigned b = 0; b < live.blocks.size(); ++b) {
+    add(liveIn, live.INs, b);
+    add(liveOut, live.OUTs, b);
+  }
+  results.put(func, ResultKind::LiveIn, std::move(liveIn));
+  results.put(func, ResultKind::LiveOut, std::move(liveOut));
+}
+
+LivenessChecker::LivenessChecker(Function &func) {
+  if (func.isDeclaration())
+    return;
+
+  // DFS numbering; an edge to a block still on the stack is a back edge,
+  // every other edge is kept in the reduced graph
+  std::vector<std::vector<unsigned>> forward, back;
+  std::vector<char> onStack;
+  std::vector<unsigned> postorder;
+  std::vector<std::pair<unsigned, unsigned>> stack; // block, next succ
+  auto visit = [&](const BasicBlock *BB) {
+    unsigned id = blocks.size();
+    blockIds[BB] = id;
+    blocks.push_back(BB);
+    forward.emplace_back();
+    back.emplace_back();
+    onStack.push_back(1);
+    stack.push_back({id, 0});
+    return id;
+  };
+  visit(&func.getEntryBlock());
+  while (!stack.empty()) {
+    unsigned b = stack.back().first;
+    const Instruction *term = blocks[b]->getTerminator();
+    unsigned next = stack.back().second++;
+    if (!term || next >= term->getNumSuccessors()) {
+      onStack[b] = 0;
+      postorder.push_back(b);
+      stack.pop_back();
+      continue;
+    }
+    const BasicBlock *succ = term->getSuccessor(next);
+    auto it = blockIds.find(succ);
+    if (it == blockIds.end()) {
+      // visit() grows forward
+      unsigned s = visit(succ);
+      forward[b].push_back(s);
+    } else if (onStack[it->second]) {
+      back[b].push_back(it->second);
+    } else {
+      forward[b].push_back(it->second);
+    }
+  }
+
+  unsigned nblocks = blocks.size();
+  DominatorTree DT(func);
+  DT.updateDFSNumbers();
+  domIn.resize(nblocks);
+  domOut.resize(nblocks);
+  for (unsigned b = 0; b < nblocks; ++b) {
+    auto *node = DT.getNode(blocks[b]);
+    domIn[b] = node->getDFSNumIn();
+    domOut[b] = node->getDFSNumOut();
+  }
+
+  // R and the back edge targets reached through it, children first
+  nwords = bitWords(nblocks);
+  reach.assign(nblocks * nwords, 0);
+  targets.assign(nblocks * nwords, 0);
+  for (unsigned b : postorder) {
+    BitWord *R = reach.data() + b * nwords;
+    BitWord *T = targets.data() + b * nwords;
+    bitSet(R, b);
+    for (unsigned t : back[b]) {
+      bitSet(T, t);
+    }
+    for (unsigned s : forward[b]) {
+      bitOr(R, reach.data() + s * nwords, nwords);
+      bitOr(T, targets.data() + s * nwords, nwords);
+    }
+  }
+}
+
+int LivenessChecker::defBlock(const Value &val) const {
+  if (isa<Argument>(val))
+    return -1;
+  auto *inst = dyn_cast<Instruction>(&val);
+  auto it = inst ? blockIds.find(inst->getParent()) : blockIds.end();
+  return it == blockIds.end() ? -2 : int(it->second);
+}
+
+void LivenessChecker::useBlocks(const Value &val,
+                                std::vector<unsigned> &uses) const {
+  uses.clear();
+  for (const Use &use : val.uses()) {
+    auto *user = dyn_cast<Instruction>(use.getUser());
+    if (!user)
+      continue;
+    auto *phi = dyn_cast<PHINode>(user);
+    auto it = blockIds.find(phi ? phi->getIncomingBlock(use)
+                                : user->getParent());
+    if (it != blockIds.end())
+      uses.push_back(it->second);
+  }
+}
+
+bool LivenessChecker::liveIn(int def, const std::vector<unsigned> &uses,
+                             unsigned q) const {
+  if (def == -2 || !strictlyDominates(def, q))
+    return false;
+  // A path from q to a use that avoids def only passes through blocks def
+  // strictly dominates, so targets outside of that are never followed.
+  SmallVector<unsigned, 8> stack = {q}, seen = {q};
+  while (!stack.empty()) {
+    unsigned t = stack.pop_back_val();
+    const BitWord *R = reach.data() + t * nwords;
+    for (unsigned u : uses) {
+      if (bitTest(R, u))
+        return true;
+    }
+    bitForEach(targets.data() + t * nwords, nwords, [&](size_t next) {
+      if (strictlyDominates(def, next) && !is_contained(seen, next)) {
+        seen.push_back(next);
+        stack.push_back(next);
+      }
+    });
+  }
+  return false;
+}
+
+bool LivenessChecker::liveOut(const Value &val, int def,
+                              const std::vector<unsigned> &uses,
+                              unsigned q) const {
+  // LiveOut(B) = PhiUses(B) + the LiveIn(S) \ PhiDefs(S) of its successors
+  for (const Use &use : val.uses()) {
+    auto *phi = dyn_cast<PHINode>(use.getUser());
+    if (phi && phi->getIncomingBlock(use) == blocks[q])
+      return true;
+  }
+  auto *phi = dyn_cast<PHINode>(&val);
+  for (const BasicBlock *succ : successors(blocks[q])) {
+    if (phi && phi->getParent() == succ)
+      continue;
+    if (liveIn(def, uses, blockIds.lookup(succ)))
+      return true;
+  }
+  return false;
+}
+
+bool LivenessChecker::isLiveIn(const Value &val, const BasicBlock &BB) const {
+  auto it = blockIds.find(&BB);
+  if (it == blockIds.end())
+    return false;
+  auto *phi = dyn_cast<PHINode>(&val);
+  if (phi && phi->getParent() == &BB)
+    return true;
+  std::vector<unsigned> uses;
+  useBlocks(val, uses);
+  return liveIn(defBlock(val), uses, it->second);
+}
+
+bool LivenessChecker::isLiveOut(const Value &val, const BasicBlock &BB) const {
+  auto it = blockIds.find(&BB);
+  if (it == blockIds.end())
+    return false;
+  std::vector<unsigned> uses;
+  useBlocks(val, uses);
+  return liveOut(val, defBlock(val), uses, it->second);
+}
+
+void LivenessChecker::liveIn(ArrayRef<const Value *> vals,
+                             const BasicBlock &BB,
+                             std::vector<const Value *> &live) const {
+  auto it = blockIds.find(&BB);
+  if (it == blockIds.end())
+    return;
+  std::vector<unsigned> uses;
+  for (auto *val : vals) {
+    auto *phi = dyn_cast<PHINode>(val);
+    if (phi && phi->getParent() == &BB) {
+      live.push_back(val);
+      continue;
+    }
+    useBlocks(*val, uses);
+    if (liveIn(defBlock(*val), uses, it->second))
+      live.push_back(val);
+  }
+}
+
+void LivenessChecker::liveOut(ArrayRef<const Value *> vals,
+                              const BasicBlock &BB,
+                              std::vector<const Value *> &live) const {
+  auto it = blockIds.find(&BB);
+  if (it == blockIds.end())
+    return;
+  std::vector<unsigned> uses;
+  for (auto *val : vals) {
+    useBlocks(*val, uses);
+    if (liveOut(*val, defBlock(*val), uses, it->second))
+      live.push_back(val);
+  }
+}
+
+void LivenessChecker::liveInIds(const Value &val,
+                                std::vector<unsigned> &live) const {
+  live.clear();
+  int def = defBlock(val);
+  if (def == -2)
+    return;
+  // Every block on a path back from a use that stops at def is live-in, so
+  // walking back costs the size of the live range instead of a query per
+  // dominated block.
+  std::vector<unsigned> stack;
+  useBlocks(val, stack);
+  DenseSet<unsigned> seen;
+  stack.erase(remove_if(stack,
+                        [&](unsigned b) { return !seen.insert(b).second; }),
+              stack.end());
+  if (isa<PHINode>(val))
+    live.push_back(def);
+  while (!stack.empty()) {
+    unsigned b = stack.back();
+    stack.pop_back();
+    if (int(b) == def)
+      continue;
+    live.push_back(b);
+    for (const BasicBlock *pred : predecessors(blocks[b])) {
+      auto it = blockIds.find(pred);
+      if (it != blockIds.end() && seen.insert(it->second).second)
+        stack.push_back(it->second);
+    }
+  }
+}
+
+void LivenessChecker::liveInBlocks(
+    const Value &val, std::vector<const BasicBlock *> &live) const {
+  std::vector<unsigned> ids;
+  liveInIds(val, ids);
+  for (unsigned b : ids) {
+    live.push_back(blocks[b]);
+  }
+}
+
+void LivenessChecker::liveOutBlocks(
+    const Value &val, std::vector<const BasicBlock *> &live) const {
+  // PhiUses(B) and the predecessors of blocks val is live-in at, other
+  // than the phi's own
+  std::vector<unsigned> ids;
+  liveInIds(val, ids);
+  DenseSet<const BasicBlock *> seen;
+  for (const Use &use : val.uses()) {
+    auto *phi = dyn_cast<PHINode>(use.getUser());
+    const BasicBlock *BB = phi ? phi->getIncomingBlock(use) : nullptr;
+    if (BB && blockIds.count(BB) && seen.insert(BB).second)
+      live.push_back(BB);
+  }
+  auto *phi = dyn_cast<PHINode>(&val);
+  for (unsigned b : ids) {
+    if (phi && phi->getParent() == blocks[b])
+      continue;
+    for (const BasicBlock *pred : predecessors(blocks[b])) {
+      if (blockIds.count(pred) && seen.insert(pred).second)
+        live.push_back(pred);
+    }
+  }
+}
+
+#ifdef VERIFY_PASSES
+void verifyLivenessChecker(Function &func, LivenessChecker &checker) {
+  BlockSets INs(taskArena()), OUTs(taskArena());
+  findLiveVars(func, INs, OUTs);
+  std::vector<Value *> vals;
+  for (auto &arg : func.args()) {
+    vals.push_back(&arg);
+  }
+  for (auto &inst : instructions(func)) {
+    if (!inst.getType()->isVoidTy())
+      vals.push_back(&inst);
+  }
+  ReversePostOrderTraversal<Function *> RPOT(&func);
+  for (BasicBlock *BB : RPOT) {
+    for (Value *val : vals) {
+      if (checker.isLiveIn(*val, *BB) != bool(INs[BB].count(val)) ||
+          checker.isLiveOut(*val, *BB) != bool(OUTs[BB].count(val))) {
+        errs() << "liveness-query: mismatch in " << func.getName() << "\n";
+        return;
+      }
+    }
+  }
+}
+#endif
+
+void storeLiveSetsQuery(Function &func, ResultStore &results,
+                        LivenessChecker &checker) {
+  DenseMap<const BasicBlock *, std::vector<Value *>> INs, OUTs;
+  std::vector<const BasicBlock *> live;
+  auto add = [&](Value &val) {
+    live.clear();
+    checker.liveInBlocks(val, live);
+    for (auto *BB : live) {
+      INs[BB].push_back(&val);
+    }
+    live.clear();
+    checker.liveOutBlocks(val, live);
+    for (auto *BB : live) {
+      OUTs[BB].push_back(&val);
+    }
+  };
+  for (auto &arg : func.args()) {
+    add(arg);
+  }
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (!inst.getType()->isVoidTy() && mayLiveAcross(inst))
+        add(inst);
+    }
+  }
+  FrozenSets liveIn, liveOut;
+  for (auto &BB : func) {
+    liveIn.add(&BB, INs[&BB]);
+    liveOut.add(&BB, OUTs[&BB]);
+  }
+  results.put(func, ResultKind::LiveIn, std::move(liveIn));
+  results.put(func, ResultKind::LiveOut, std::move(liveOut));
+}
+
+ArrayRef<ResultKind> LivenessAnalysis::resultKinds() const {
+  static const ResultKind kinds[] = {ResultKind::LiveIn, ResultKind::LiveOut};
+  return kinds;
+}
+
+std::string LivenessAnalysis::name() const {
+  switch (engine) {
+  case LivenessEngine::BitVector:
+    return "liveness-bv";
+  case LivenessEngine::Query:
+    return "liveness-query";
+  case LivenessEngine::LoopForest:
+    return "liveness-loops";
+  default:
+    return "liveness";
+  }
+}
+
+#ifdef PRINT_STATS
+LivenessAnalysis::~LivenessAnalysis() {
+  if (engine == LivenessEngine::Query)
+    return;
+  outs() << "\t" << name() << ": " << visits << " block visits";
+  if (engine == LivenessEngine::LoopForest)
+    outs() << ", " << irreducible << " irreducible functions";
+  outs() << "\n";
+}
+#endif
+
+void LivenessAnalysis::finishDense(Function &func, DenseLiveness &live) {
+#ifdef VERIFY_PASSES
+  verifyLiveVarsDense(func, live, name());
+#endif
+#ifdef PRINT_STATS
+  visits += live.visits;
+  irreducible += live.irreducible;
+#endif
+  if (results && results->covers(func))
+    storeLiveSetsDense(func, *results, live);
+}
+
+// The dense engines split by value: part p solves its share of the words of
+// every row, for all blocks, and the join adds the unreachable blocks.
+class LivenessSplit : public SplitTask {
+private:
+  LivenessAnalysis &pass;
+  Function &func;
+  DenseLiveness live;
+  LoopForest forest;
+  bool loops;
+  unsigned nparts = 0;
+  std::atomic<size_t> visits{0};
+
+public:
+  LivenessSplit(LivenessAnalysis &pass, Function &func, bool loops)
+      : pass(pass), func(func), loops(loops) {
+    prepareLiveVarsDense(func, live);
+    if (loops) {
+      findLoopForest(live, live.blockIds[&func.getEntryBlock()], forest);
+      live.irreducible = forest.irreducible;
+    }
+  }
+  size_t words() const { return live.nwords; }
+  void setParts(unsigned count) { nparts = count; }
+  unsigned parts() const override { return nparts; }
+  void runPart(unsigned part) override {
+    size_t lo = live.nwords * part / nparts;
+    size_t hi = live.nwords * (part + 1) / nparts;
+    if (loops && !forest.irreducible)
+      visits += solveLiveVarsLoops(live, forest, lo, hi);
+    else
+      visits += solveLiveVarsDense(live, live.order, lo, hi, true);
+  }
+  void join() override {
+    live.visits = visits + solveUnreachableDense(live);
+    pass.finishDense(func, live);
+  }
+};
+
+std::unique_ptr<SplitTask> LivenessAnalysis::split(Function &func,
+                                                   unsigned nparts) {
+  if (engine != LivenessEngine::BitVector &&
+      engine != LivenessEngine::LoopForest) {
+    run(func);
+    return nullptr;
+  }
+  auto task = std::make_unique<LivenessSplit>(
+      *this, func, engine == LivenessEngine::LoopForest);
+  task->setParts(std::min<size_t>(nparts, task->words()));
+  if (task->parts() < 2) {
+    task->setParts(1);
+    task->runPart(0);
+    task->join();
+    return nullptr;
+  }
+  return task;
+}
+
+void LivenessAnalysis::run(Function &func) {
+  switch (engine) {
+  case LivenessEngine::BitVector:
+  case LivenessEngine::LoopForest: {
+    DenseLiveness live;
+    if (engine == LivenessEngine::LoopForest)
+      findLiveVarsLoops(func, live);
+    else
+      findLiveVarsDense(func, live);
+    finishDense(func, live);
+    break;
+  }
+  case LivenessEngine::Query: {
+    // answering every query only pays off with somewhere to put them
+    LivenessChecker checker(func);
+#ifdef VERIFY_PASSES
+    verifyLivenessChecker(func, checker);
+#endif
+    if (results && results->covers(func))
+      storeLiveSetsQuery(func, *results, checker);
+    break;
+  }
+  default: {
+    BlockSets INs(taskArena()), OUTs(taskArena());
+#ifdef PRINT_STATS
+    visits += findLiveVars(func, INs, OUTs);
+#else
+    findLiveVars(func, INs, OUTs);
+#endif
+    if (results && results->covers(func))
+      storeLiveSets(func, *results, INs, OUTs);
+    break;
+  }
+  }
 }
@@ -1,36 +1,506 @@
 #pragma once
 
+#include "arena.hpp"
+#include "cache.hpp"
+#include "counters.hpp"
+#include "results.hpp"
+#include "trace.hpp"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Runs worker(tid) for tid in [0, nworkers) on the threads of the scheduler
+// preparing a pass and returns once all of them are done.
+using WorkerRunner =
+    std::function<void(unsigned, const std::function<void(int)> &)>;
+
+// The parts of one run() on a large function, from FuncPass::split().
+// Every part runs once, possibly concurrently with the others and on any
+// thread; join() runs after the last one and finishes the job, results
+// included. Parts allocate what outlives them on the heap, since every
+// task's arena is rewound.
+class SplitTask {
+public:
+  virtual ~SplitTask() = default;
+  virtual unsigned parts() const = 0;
+  virtual void runPart(unsigned part) = 0;
+  virtual void join() = 0;
+};
 
 class FuncPass {
+protected:
+  // where run() leaves its results, if anywhere
+  std::shared_ptr<ResultStore> results;
+  // earlier runs' results, if any
+  std::shared_ptr<AnalysisCache> cache;
+  // per-task accounting of every runTask() so far
+  std::atomic<size_t> arenaAllocs{0}, arenaBytes{0};
+  std::atomic<long> busyNanos{0};
+  std::array<std::atomic<uint64_t>, MaxCounters> counterTotals{};
+
+  // fn() timed, traced as event and counted, then this thread's arena
+  // rewound; returns the nanoseconds it took
+  template <typename Fn>
+  long account(llvm::Function &func, const char *event, Fn fn) {
+    bool counted = PerfCounters::enabled();
+    CounterValues before{}, after{};
+    if (counted)
+      counted = PerfCounters::local().read(before);
+    bool traced = Trace::enabled();
+    uint64_t traceBegin = traced ? Trace::now() : 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    if (traced)
+      Trace::record(event, name(), traceBegin, Trace::now(), &func);
+    long nanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+    if (counted && PerfCounters::local().read(after)) {
+      for (size_t i = 0; i < MaxCounters; ++i) {
+        counterTotals[i].fetch_add(after[i] - before[i],
+                                   std::memory_order_relaxed);
+      }
+    }
+    busyNanos.fetch_add(nanos, std::memory_order_relaxed);
+    TaskArena &arena = TaskArena::local();
+    arenaAllocs.fetch_add(arena.allocations(), std::memory_order_relaxed);
+    arenaBytes.fetch_add(arena.allocatedBytes(), std::memory_order_relaxed);
+    arena.reset();
+    return nanos;
+  }
+
 public:
   virtual ~FuncPass() = default;
+  void setResultStore(std::shared_ptr<ResultStore> store) {
+    results = std::move(store);
+  }
+  void setCache(std::shared_ptr<AnalysisCache> newcache) {
+    cache = std::move(newcache);
+  }
+  // Called by the scheduler once per module before any run() on its
+  // functions, never concurrently with run(), with the number of threads
+  // the scheduler runs and a way to run work on them.
+  virtual void prepare(llvm::Module &module, unsigned nthreads,
+                       const WorkerRunner &runWorkers) {}
+  // Drop what prepare() kept, before its module goes away: a later module
+  // may be allocated at the same address.
+  virtual void release() {}
   virtual void run(llvm::Function &func) = 0;
   virtual std::string name() const = 0;
+  // run(func) split into at most nparts parts, or nullptr once it has run
+  // whole, which is all passes without parallel parts do.
+  virtual std::unique_ptr<SplitTask> split(llvm::Function &func,
+                                           unsigned nparts) {
+    run(func);
+    return nullptr;
+  }
+
+  // Cache keys: bump version whenever run() computes something different.
+  // The kinds are what run() puts into the ResultStore. Passes whose
+  // results depend on more than the function body fold that into
+  // cacheContext(), or opt out with cacheable().
+  virtual unsigned version() const { return 1; }
+  virtual llvm::ArrayRef<ResultKind> resultKinds() const { return {}; }
+  virtual bool cacheable(const llvm::Function &func) const { return true; }
+  virtual uint64_t cacheContext(const llvm::Function &func) const {
+    return 0;
+  }
+
+  // What schedulers call: run(), timed and traced, and then rewind this
+  // thread's arena. With a cache, a cached task only loads its results.
+  void runTask(llvm::Function &func) {
+    uint64_t cacheKey = 0;
+    bool cached = cache && cacheable(func);
+    if (cached) {
+      auto start = std::chrono::high_resolution_clock::now();
+      cacheKey = AnalysisCache::key(func, name(), version(),
+                                    cacheContext(func));
+      bool traced = Trace::enabled();
+      uint64_t traceBegin = traced ? Trace::now() : 0;
+      if (cache->load(cacheKey, func, results.get(), resultKinds())) {
+        if (traced)
+          Trace::record("cache", name(), traceBegin, Trace::now(), &func);
+        auto end = std::chrono::high_resolution_clock::now();
+        busyNanos.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                .count(),
+            std::memory_order_relaxed);
+        return;
+      }
+    }
+
+    long nanos = account(func, "task", [&] { run(func); });
+    if (cached)
+      cache->store(cacheKey, func, results.get(), resultKinds(), nanos);
+  }
+  // split(), one part and the join, accounted like runTask(). With a cache
+  // functions are not split, so cached results stay whole-task timed.
+  std::unique_ptr<SplitTask> splitTask(llvm::Function &func, unsigned nparts) {
+    if (cache && cacheable(func)) {
+      runTask(func);
+      return nullptr;
+    }
+    std::unique_ptr<SplitTask> task;
+    account(func, "task", [&] { task = split(func, nparts); });
+    return task;
+  }
+  void runPartTask(SplitTask &task, llvm::Function &func, unsigned part) {
+    account(func, "part", [&] { task.runPart(part); });
+  }
+  void joinTask(SplitTask &task, llvm::Function &func) {
+    account(func, "join", [&] { task.join(); });
+  }
+  // summed over tasks, so with several workers busy time exceeds wall time
+  long busyMicros() const { return busyNanos / 1000; }
+  size_t arenaAllocations() const { return arenaAllocs; }
+  size_t arenaAllocatedBytes() const { return arenaBytes; }
+  // PerfCounters::names() order, zero while counters are disabled
+  CounterValues counters() const {
+    CounterValues values;
+    for (size_t i = 0; i < MaxCounters; ++i) {
+      values[i] = counterTotals[i];
+    }
+    return values;
+  }
+  void resetTaskStats() {
+    busyNanos = 0;
+    arenaAllocs = 0;
+    arenaBytes = 0;
+    for (auto &total : counterTotals) {
+      total = 0;
+    }
+  }
 };
 
+// A pass over a whole module at once. PassMan runs these after the
+// FuncPasses of every run; they bring their own threads.
+class ModulePass {
+protected:
+  std::shared_ptr<ResultStore> results;
+  unsigned nthreads = 1;
+  std::atomic<long> busyNanos{0};
+
+public:
+  virtual ~ModulePass() = default;
+  void setResultStore(std::shared_ptr<ResultStore> store) {
+    results = std::move(store);
+  }
+  void setThreads(unsigned count) { nthreads = std::max(1u, count); }
+  virtual void run(llvm::Module &module) = 0;
+  virtual std::string name() const = 0;
+  virtual llvm::ArrayRef<ResultKind> resultKinds() const { return {}; }
+
+  // run(), timed and traced as one task
+  void runTask(llvm::Module &module) {
+    bool traced = Trace::enabled();
+    uint64_t traceBegin = traced ? Trace::now() : 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    run(module);
+    auto end = std::chrono::high_resolution_clock::now();
+    if (traced)
+      Trace::record("task", name(), traceBegin, Trace::now());
+    busyNanos.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count(),
+        std::memory_order_relaxed);
+  }
+  long busyMicros() const { return busyNanos / 1000; }
+  void resetTaskStats() { busyNanos = 0; }
+};
+
+// Set keeps per-block std::set<Value *> maps, BitVector numbers the values
+// of a function densely and keeps every block's sets in flat word arrays.
+// Query builds a LivenessChecker and only answers queries; its sets are
+// those of the reachable blocks. LoopForest fills the BitVector sets
+// without iterating, by a post-order pass and a pass over the loop nesting
+// forest, and falls back to the worklist on irreducible CFGs.
+enum class LivenessEngine { Set, BitVector, Query, LoopForest };
+
+// Liveness queries on a function in SSA form without dataflow iteration
+// (Boissinot et al., fast liveness checking). One DFS classifies back
+// edges. For every block it then keeps the blocks reachable without back
+// edges (R) and the targets of the back edges leaving those (T), as bit
+// rows in DFS preorder, plus its dominator tree interval. Val is live-in
+// at B if B is strictly dominated by val's definition d and R reaches a
+// use from B or from a target reached from B through T, stepping only on
+// targets d strictly dominates. A query touches those targets and val's
+// uses and nothing else. Blocks unreachable from the entry have nothing
+// live.
+class LivenessChecker {
+private:
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> blockIds;
+  std::vector<const llvm::BasicBlock *> blocks;
+  std::vector<unsigned> domIn, domOut;
+  size_t nwords = 0;
+  std::vector<uint64_t> reach, targets;
+
+  bool strictlyDominates(int a, unsigned b) const {
+    return a < 0 ||
+           (unsigned(a) != b && domIn[a] <= domIn[b] && domOut[b] <= domOut[a]);
+  }
+  // -1 for arguments, which are defined above the entry, -2 if val has no
+  // reachable definition
+  int defBlock(const llvm::Value &val) const;
+  // blocks of val's uses, a phi's at the end of the incoming block
+  void useBlocks(const llvm::Value &val, std::vector<unsigned> &uses) const;
+  // val is not a phi of q
+  bool liveIn(int def, const std::vector<unsigned> &uses, unsigned q) const;
+  bool liveOut(const llvm::Value &val, int def,
+               const std::vector<unsigned> &uses, unsigned q) const;
+  void liveInIds(const llvm::Value &val, std::vector<unsigned> &live) const;
+
+public:
+  explicit LivenessChecker(llvm::Function &func);
+
+  bool isLiveIn(const llvm::Value &val, const llvm::BasicBlock &BB) const;
+  bool isLiveOut(const llvm::Value &val, const llvm::BasicBlock &BB) const;
+  // Batches: the values in vals live-in (live-out) at BB, in vals' order,
+  // and the blocks val is live-in (live-out) at, in no particular order.
+  void liveIn(llvm::ArrayRef<const llvm::Value *> vals,
+              const llvm::BasicBlock &BB,
+              std::vector<const llvm::Value *> &live) const;
+  void liveOut(llvm::ArrayRef<const llvm::Value *> vals,
+               const llvm::BasicBlock &BB,
+               std::vector<const llvm::Value *> &live) const;
+  void liveInBlocks(const llvm::Value &val,
+                    std::vector<const llvm::BasicBlock *> &live) const;
+  void liveOutBlocks(const llvm::Value &val,
+                     std::vector<const llvm::BasicBlock *> &live) const;
+};
+
+struct DenseLiveness;
+
 class LivenessAnalysis : public FuncPass {
+private:
+  LivenessEngine engine;
+#ifdef PRINT_STATS
+  // blocks whose sets were computed or widened, summed over split parts
+  std::atomic<size_t> visits{0}, irreducible{0};
+#endif
+
+  // verify, count and store the sets of the dense engines
+  void finishDense(llvm::Function &func, DenseLiveness &live);
+  friend class LivenessSplit;
+
 public:
+  LivenessAnalysis() : engine(LivenessEngine::Set) {}
+  explicit LivenessAnalysis(LivenessEngine engine) : engine(engine) {}
+#ifdef PRINT_STATS
+  ~LivenessAnalysis() override;
+#endif
   void run(llvm::Function &func) override;
-  std::string name() const override { return "liveness"; }
+  // BitVector and LoopForest split by value
+  std::unique_ptr<SplitTask> split(llvm::Function &func,
+                                   unsigned nparts) override;
+  std::string name() const override;
+  llvm::ArrayRef<ResultKind> resultKinds() const override;
+};
+
+// Set is the original solver over std::set<Value *> worklist entries, Sparse
+// uses dense node ids, CSR edges, sparse bit sets and difference propagation.
+// Unification is Steensgaard's near-linear, less precise solver over the same
+// constraints.
+enum class Points2Engine { Set, Sparse, Unification };
+
+// Cycle elimination in the Sparse engine: nodes folded into another one,
+// cycles found, and copy-edge propagations skipped inside collapsed cycles.
+struct Points2Stats {
+  size_t collapsed = 0;
+  size_t cycles = 0;
+  size_t skipped = 0;
 };
 
 class Points2Analysis : public FuncPass {
+private:
+  Points2Engine engine;
+#ifdef PRINT_STATS
+  std::atomic<size_t> collapsed{0}, cycles{0}, skipped{0};
+#endif
+
 public:
+  Points2Analysis() : engine(Points2Engine::Sparse) {}
+  explicit Points2Analysis(Points2Engine engine) : engine(engine) {}
+#ifdef PRINT_STATS
+  ~Points2Analysis() override;
+#endif
   void run(llvm::Function &func) override;
-  std::string name() const override { return "points-to"; }
+  std::string name() const override;
+  llvm::ArrayRef<ResultKind> resultKinds() const override;
 };
 
+// Traversal runs a separate BFS from every root, Condensed builds the
+// dependence and use graphs once, condenses them into SCCs and keeps
+// reachability closures as bit rows, so every root's slice is a lookup.
+enum class SliceEngine { Traversal, Condensed };
+
 class Slicing : public FuncPass {
+private:
+  SliceEngine engine;
+
 public:
+  Slicing() : engine(SliceEngine::Condensed) {}
+  explicit Slicing(SliceEngine engine) : engine(engine) {}
   void run(llvm::Function &func) override;
-  std::string name() const override { return "slicing"; }
+  std::unique_ptr<SplitTask> split(llvm::Function &func,
+                                   unsigned nparts) override;
+  std::string name() const override;
+  // 2: results hold every root's slice
+  unsigned version() const override { return 2; }
+  llvm::ArrayRef<ResultKind> resultKinds() const override;
+};
+
+// 0-CFA points-to sets of every global variable in a module, solved once and
+// then shared read-only by all ZeroCFAnalysis::run calls on that module.
+class GlobalPoints2 {
+private:
+  const llvm::Module *module = nullptr;
+  llvm::DenseMap<const llvm::GlobalVariable *, llvm::DenseSet<llvm::Value *>>
+      summaries;
+
+public:
+  static std::shared_ptr<const GlobalPoints2>
+  compute(llvm::Module &module, unsigned nthreads,
+          const WorkerRunner &runWorkers);
+  const llvm::Module *getModule() const { return module; }
+  const llvm::DenseSet<llvm::Value *> *
+  lookup(const llvm::GlobalVariable *global) const;
+  // Stable across runs: the summaries plus the stores through constant
+  // expressions, which run() also reads module-wide.
+  uint64_t hash() const;
+};
+
+// Interprocedural 0-CFA of a module. Every function is summarized on its
+// own: what its returns, call arguments and callee operands point to, with
+// arguments, call results and other functions' values (through globals)
+// left as placeholders. Returns are then substituted bottom-up and
+// parameters top-down over the SCCs of the call graph, SCCs whose
+// neighbours are done in parallel, and the whole is repeated while
+// resolved indirect calls add call graph edges.
+class CallSummaries {
+private:
+  const llvm::Module *module = nullptr;
+  llvm::DenseMap<const llvm::CallInst *, llvm::DenseSet<llvm::Value *>>
+      callees;
+
+public:
+  // call graph rounds, SCCs and largest SCC of the last round
+  unsigned rounds = 0;
+  size_t sccs = 0, maxSCC = 0;
+
+  static std::shared_ptr<const CallSummaries>
+  compute(llvm::Module &module, const GlobalPoints2 *globals,
+          unsigned nthreads, const WorkerRunner &runWorkers);
+  const llvm::Module *getModule() const { return module; }
+  // What the callee operand may be: functions, plus values still unknown
+  // (arguments of functions called from outside, results of external
+  // calls).
+  const llvm::DenseSet<llvm::Value *> *
+  lookup(const llvm::CallInst *call) const;
 };
 
+// Intraprocedural treats every argument and call result as itself,
+// Interprocedural resolves them with CallSummaries.
+enum class CFAMode { Intraprocedural, Interprocedural };
+
 class ZeroCFAnalysis : public FuncPass {
+private:
+  CFAMode mode;
+  // only used for functions of the module they were computed on, until
+  // release()
+  std::shared_ptr<const GlobalPoints2> globals;
+  std::shared_ptr<const CallSummaries> summaries;
+  // what a function's callees depend on beyond its body
+  uint64_t globalsHash = 0;
+
 public:
+  ZeroCFAnalysis() : mode(CFAMode::Intraprocedural) {}
+  explicit ZeroCFAnalysis(CFAMode mode) : mode(mode) {}
+  void prepare(llvm::Module &module, unsigned nthreads,
+               const WorkerRunner &runWorkers) override;
+  void release() override;
   void run(llvm::Function &func) override;
-  std::string name() const override { return "0-CFA"; }
+  std::string name() const override;
+  llvm::ArrayRef<ResultKind> resultKinds() const override;
+  // Without summaries for its module a function's callees depend on every
+  // store in whatever module it is in, so only those with summaries are
+  // cached. Interprocedural callees depend on the whole module.
+  bool cacheable(const llvm::Function &func) const override {
+    return mode == CFAMode::Intraprocedural && globals &&
+           globals->getModule() == func.getParent();
+  }
+  uint64_t cacheContext(const llvm::Function &func) const override {
+    return globalsHash;
+  }
+};
+
+// Points-to sets of a whole module. Objects are allocation sites: allocas,
+// globals, functions and calls to allocation functions, each with one
+// field-insensitive memory cell. Arguments take every actual of every call
+// that may reach them, call results every return of every possible callee,
+// and indirect calls are resolved while solving. compute() is inclusion
+// based (Andersen), unify() joins classes instead (Steensgaard) and its
+// sets include compute()'s.
+class ModulePoints2 {
+private:
+  const llvm::Module *module = nullptr;
+  std::vector<const llvm::Value *> objects;
+  // distinct sets of sorted object ids, shared by the values in setIds
+  std::vector<std::vector<unsigned>> sets;
+  llvm::DenseMap<const llvm::Value *, unsigned> setIds;
+
+  llvm::ArrayRef<unsigned> lookup(const llvm::Value *val) const;
+
+public:
+  // solver rounds, nodes, edges (joins for unify) and partition messages
+  size_t rounds = 0, nodes = 0, edges = 0, messages = 0;
+
+  static std::shared_ptr<const ModulePoints2> compute(llvm::Module &module,
+                                                      unsigned nthreads);
+  static std::shared_ptr<const ModulePoints2> unify(llvm::Module &module);
+  const llvm::Module *getModule() const { return module; }
+  // the allocation sites val may point to, looking through constant casts
+  void pointsTo(const llvm::Value *val,
+                std::vector<const llvm::Value *> &objs) const;
+  bool mayAlias(const llvm::Value *a, const llvm::Value *b) const;
+  // sum of the set sizes of all values, the precision measure
+  size_t totalSize() const;
+  bool operator==(const ModulePoints2 &other) const;
+  // whether every set of other is a subset of this one's
+  bool includes(const ModulePoints2 &other) const;
+};
+
+// Inclusion solves ModulePoints2::compute on nthreads workers, each owning
+// the nodes of a share of the functions; Unification is the single-threaded
+// near-linear ModulePoints2::unify. Every function's sets of its arguments
+// and instructions go to the ResultStore as ModulePoints2.
+enum class ModulePoints2Engine { Inclusion, Unification };
+
+class ModulePoints2Analysis : public ModulePass {
+private:
+  ModulePoints2Engine engine;
+  std::shared_ptr<const ModulePoints2> solution;
+
+public:
+  ModulePoints2Analysis() : engine(ModulePoints2Engine::Inclusion) {}
+  explicit ModulePoints2Analysis(ModulePoints2Engine engine)
+      : engine(engine) {}
+  void run(llvm::Module &module) override;
+  std::string name() const override;
+  llvm::ArrayRef<ResultKind> resultKinds() const override;
+  // the last run's
+  std::shared_ptr<const ModulePoints2> getSolution() const { return solution; }
 };
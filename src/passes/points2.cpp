@@ -1,5 +1,8 @@
 #include "passes.hpp"
+#include "bitvec.hpp"
+#include "unify.hpp"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/CFG.h"
@@ -9,17 +12,28 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <deque>
+#include <memory_resource>
 #include <queue>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 using namespace llvm;
 
+// pass-local sets of the Set engine live in the task arena
+using ValueSet = std::pmr::set<Value *>;
+using ValueSets = std::pmr::unordered_map<Value *, ValueSet>;
+
 struct LocalData {
-  std::unordered_map<Value *, std::set<Value *>> pt;
-  std::queue<std::pair<Value *, std::set<Value *>>> worklist;
-  std::unordered_map<Value *, std::set<Value *>> PFG;
+  ValueSets pt{taskArena()};
+  std::queue<std::pair<Value *, ValueSet>,
+             std::pmr::deque<std::pair<Value *, ValueSet>>>
+      worklist{taskArena()};
+  ValueSets PFG{taskArena()};
 
   ~LocalData() {}
 };
@@ -31,19 +45,19 @@ void addEdge(Value *s, Value *t, LocalData &localdata) {
   if (PFG[s].find(t) == PFG[s].end()) {
     PFG[s].insert(t);
     if (!pt[s].empty()) {
-      worklist.push({t, pt[s]});
+      worklist.emplace(t, pt[s]);
     }
   }
 }
 
-void propagate(Value *n, const std::set<Value *> &pts, LocalData &localdata) {
+void propagate(Value *n, const ValueSet &pts, LocalData &localdata) {
   auto &pt = localdata.pt;
   auto &worklist = localdata.worklist;
   auto &PFG = localdata.PFG;
   if (!pts.empty()) {
     pt[n].insert(pts.begin(), pts.end());
     for (auto *s : PFG[n]) {
-      worklist.push({s, pts});
+      worklist.emplace(s, pts);
     }
   }
 }
@@ -54,10 +68,10 @@ void initialize(Function &func, LocalData &localdata) {
     for (auto &inst : BB) {
 
       if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
-        worklist.push({alloca, {alloca}});
+        worklist.emplace(alloca, ValueSet({alloca}, taskArena()));
 
       } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
-        worklist.push({gep, {gep}});
+        worklist.emplace(gep, ValueSet({gep}, taskArena()));
 
       } else if (auto *phi = dyn_cast<PHINode>(&inst)) {
         for (int i = 0; i < phi->getNumIncomingValues(); ++i) {
@@ -91,10 +105,10 @@ void solve(LocalData &localdata) {
   auto &worklist = localdata.worklist;
   // auto &PFG = localdata.PFG;
   while (!worklist.empty()) {
-    auto [n, pts] = worklist.front();
+    auto [n, pts] = std::move(worklist.front());
     worklist.pop();
 
-    std::set<Value *> delta;
+    ValueSet delta(taskArena());
     std::set_difference(pts.begin(), pts.end(), pt[n].begin(), pt[n].end(),
                         std::inserter(delta, delta.begin()));
     propagate(n, delta, localdata);
@@ -125,8 +139,547 @@ void solve(LocalData &localdata) {
   }
 }
 
-void Points2Analysis::run(Function &func) {
+// Dense variant of the above with difference propagation. Arguments and
+// non-void instructions are nodes 0..n-1; allocas and GEPs are also objects
+// 0..m-1, and points-to sets are sparse bit sets over object ids. Each node
+// keeps the part of its incoming sets it has not seen yet in pending and is
+// on the worklist while that is non-empty.
+//
+// Copy cycles (phi/cast loops, and loops closed by load/store edges) are
+// collapsed into one representative with union-find. The members of a
+// representative form a circular list through nextMember, and only the
+// representative's pt/pending are live. The worklist is drained in waves,
+// each sorted into topological order of the last collapse; nodes pushed
+// during a wave wait for the next one.
+struct DensePoints2 {
+  std::vector<Value *> nodes;
+  DenseMap<Value *, unsigned> nodeIds;
+  std::vector<unsigned> objects; // object id -> node id
+  // phi/select/cast copy edges, then for every pointer the loads through it
+  // and the values stored through it, all in CSR form
+  std::vector<unsigned> edgeBegin, edges;
+  std::vector<unsigned> loadBegin, loads;
+  std::vector<unsigned> storeBegin, stores;
+  // load/store edges found while solving
+  std::vector<std::vector<unsigned>> newEdges;
+  DenseSet<std::pair<unsigned, unsigned>> newEdgeSet;
+
+  std::vector<unsigned> parent, nextMember, rank;
+  unsigned edgesSinceCollapse = 0;
+
+  std::vector<SparseBits> pt, pending;
+  std::vector<unsigned> worklist;
+  std::vector<char> inWL;
+
+  Points2Stats stats;
+};
+
+unsigned findRep(unsigned n, DensePoints2 &pts) {
+  while (pts.parent[n] != n) {
+    pts.parent[n] = pts.parent[pts.parent[n]];
+    n = pts.parent[n];
+  }
+  return n;
+}
+
+void pushDense(unsigned n, DensePoints2 &pts) {
+  if (!pts.inWL[n]) {
+    pts.inWL[n] = 1;
+    pts.worklist.push_back(n);
+  }
+}
+
+// fn(t) for every copy target t of every member of representative n
+template <typename Fn> void forEachCopy(unsigned n, DensePoints2 &pts, Fn fn) {
+  unsigned m = n;
+  do {
+    for (unsigned i = pts.edgeBegin[m]; i < pts.edgeBegin[m + 1]; ++i) {
+      fn(pts.edges[i]);
+    }
+    for (unsigned t : pts.newEdges[m]) {
+      fn(t);
+    }
+    m = pts.nextMember[m];
+  } while (m != n);
+}
+
+void buildCSR(unsigned nnodes,
+              std::vector<std::pair<unsigned, unsigned>> &pairs,
+              std::vector<unsigned> &begin, std::vector<unsigned> &targets) {
+  begin.assign(nnodes + 1, 0);
+  for (auto &[s, t] : pairs) {
+    begin[s + 1]++;
+  }
+  for (unsigned n = 0; n < nnodes; ++n) {
+    begin[n + 1] += begin[n];
+  }
+  targets.resize(pairs.size());
+  std::vector<unsigned> fill(begin.begin(), begin.end() - 1);
+  for (auto &[s, t] : pairs) {
+    targets[fill[s]++] = t;
+  }
+}
+
+void initializeDense(Function &func, DensePoints2 &pts) {
+  auto number = [&](Value *val) {
+    pts.nodeIds[val] = pts.nodes.size();
+    pts.nodes.push_back(val);
+  };
+  for (auto &arg : func.args()) {
+    number(&arg);
+  }
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (!inst.getType()->isVoidTy())
+        number(&inst);
+    }
+  }
+  auto id = [&](Value *val) -> int {
+    if (!isa<Instruction>(val) && !isa<Argument>(val))
+      return -1;
+    auto it = pts.nodeIds.find(val);
+    return it == pts.nodeIds.end() ? -1 : (int)it->second;
+  };
+
+  unsigned nnodes = pts.nodes.size();
+  pts.pt.resize(nnodes);
+  pts.pending.resize(nnodes);
+  pts.inWL.assign(nnodes, 0);
+  pts.newEdges.resize(nnodes);
+  pts.parent.resize(nnodes);
+  pts.nextMember.resize(nnodes);
+  for (unsigned n = 0; n < nnodes; ++n) {
+    pts.parent[n] = pts.nextMember[n] = n;
+  }
+  pts.rank.assign(nnodes, 0);
+
+  // constants never receive a points-to set, so edges out of them are
+  // dropped
+  std::vector<std::pair<unsigned, unsigned>> copies, loads, stores;
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (isa<AllocaInst>(inst) || isa<GetElementPtrInst>(inst)) {
+        unsigned n = pts.nodeIds[&inst];
+        pts.pending[n].set(pts.objects.size());
+        pts.objects.push_back(n);
+
+      } else if (auto *phi = dyn_cast<PHINode>(&inst)) {
+        for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+          int src = id(phi->getIncomingValue(i));
+          if (src >= 0)
+            copies.push_back({src, pts.nodeIds[phi]});
+        }
+
+      } else if (auto *select = dyn_cast<SelectInst>(&inst)) {
+        for (Value *val : {select->getTrueValue(), select->getFalseValue()}) {
+          int src = id(val);
+          if (src >= 0)
+            copies.push_back({src, pts.nodeIds[select]});
+        }
+
+      } else if (auto *cast = dyn_cast<CastInst>(&inst)) {
+        int src = id(cast->getOperand(0));
+        if (src >= 0)
+          copies.push_back({src, pts.nodeIds[cast]});
+
+      } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
+        int ptr = id(load->getPointerOperand());
+        if (ptr >= 0)
+          loads.push_back({ptr, pts.nodeIds[load]});
+
+      } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+        int ptr = id(store->getPointerOperand());
+        int val = id(store->getValueOperand());
+        if (ptr >= 0 && val >= 0)
+          stores.push_back({ptr, val});
+      }
+    }
+  }
+  buildCSR(nnodes, copies, pts.edgeBegin, pts.edges);
+  buildCSR(nnodes, loads, pts.loadBegin, pts.loads);
+  buildCSR(nnodes, stores, pts.storeBegin, pts.stores);
+}
+
+// Folds the representatives in scc into scc[0]. Its pt becomes what every
+// member already had, so the members' edges have seen all of it; the rest
+// of their sets goes to pending and is sent along all the merged edges.
+void mergeDense(const std::vector<unsigned> &scc, DensePoints2 &pts) {
+  unsigned r = scc[0];
+  SparseBits all = pts.pt[r];
+  all.unionWith(pts.pending[r]);
+  for (size_t i = 1; i < scc.size(); ++i) {
+    unsigned m = scc[i];
+    all.unionWith(pts.pt[m]);
+    all.unionWith(pts.pending[m]);
+    pts.pt[r].intersectWith(pts.pt[m]);
+    pts.pt[m].clear();
+    pts.pending[m].clear();
+    pts.parent[m] = r;
+    std::swap(pts.nextMember[r], pts.nextMember[m]);
+  }
+  all.subtract(pts.pt[r]);
+  pts.pending[r].swap(all);
+  pts.stats.collapsed += scc.size() - 1;
+  pts.stats.cycles++;
+}
+
+// Tarjan's algorithm over the representatives and their copy edges, with an
+// explicit call stack. SCCs come out sinks first, so their index is a
+// topological rank with sources highest. The worklist is rebuilt from the
+// surviving representatives.
+void collapseDense(DensePoints2 &pts) {
+  unsigned nnodes = pts.nodes.size();
+  std::vector<std::pair<unsigned, unsigned>> pairs;
+  for (unsigned n = 0; n < nnodes; ++n) {
+    if (pts.parent[n] != n)
+      continue;
+    forEachCopy(n, pts, [&](unsigned t) {
+      t = findRep(t, pts);
+      if (t != n)
+        pairs.push_back({n, t});
+    });
+  }
+  std::vector<unsigned> succBegin, succs;
+  buildCSR(nnodes, pairs, succBegin, succs);
+
+  std::vector<unsigned> index(nnodes, 0), low(nnodes), stack, scc;
+  std::vector<char> onStack(nnodes, 0);
+  std::vector<std::pair<unsigned, unsigned>> calls; // node, next succ
+  unsigned counter = 0, nsccs = 0;
+  auto visit = [&](unsigned n) {
+    index[n] = low[n] = ++counter;
+    stack.push_back(n);
+    onStack[n] = 1;
+    calls.push_back({n, succBegin[n]});
+  };
+  for (unsigned root = 0; root < nnodes; ++root) {
+    if (pts.parent[root] != root || index[root])
+      continue;
+    visit(root);
+    while (!calls.empty()) {
+      unsigned n = calls.back().first;
+      unsigned i = calls.back().second;
+      if (i < succBegin[n + 1]) {
+        calls.back().second++;
+        unsigned t = succs[i];
+        if (!index[t])
+          visit(t);
+        else if (onStack[t])
+          low[n] = std::min(low[n], index[t]);
+        continue;
+      }
+      calls.pop_back();
+      if (!calls.empty()) {
+        unsigned caller = calls.back().first;
+        low[caller] = std::min(low[caller], low[n]);
+      }
+      if (low[n] != index[n])
+        continue;
+      scc.clear();
+      unsigned m;
+      do {
+        m = stack.back();
+        stack.pop_back();
+        onStack[m] = 0;
+        scc.push_back(m);
+      } while (m != n);
+      if (scc.size() > 1)
+        mergeDense(scc, pts);
+      pts.rank[scc[0]] = nsccs++;
+    }
+  }
+
+  pts.worklist.clear();
+  for (unsigned n = 0; n < nnodes; ++n) {
+    pts.inWL[n] = 0;
+    if (pts.parent[n] == n && !pts.pending[n].empty())
+      pushDense(n, pts);
+  }
+  pts.edgesSinceCollapse = 0;
+}
+
+// pending(t) |= set \ pt(t), t a representative
+void sendDense(unsigned t, const SparseBits &set, DensePoints2 &pts) {
+  if (pts.pending[t].unionWith(set, &pts.pt[t]))
+    pushDense(t, pts);
+}
+
+void addEdgeDense(unsigned s, unsigned t, DensePoints2 &pts) {
+  s = findRep(s, pts);
+  t = findRep(t, pts);
+  if (s == t || !pts.newEdgeSet.insert({s, t}).second)
+    return;
+  pts.newEdges[s].push_back(t);
+  pts.edgesSinceCollapse++;
+  if (!pts.pt[s].empty())
+    sendDense(t, pts.pt[s], pts);
+}
+
+void solveDense(DensePoints2 &pts) {
+  // load/store edges close new cycles, so collapse again once enough of
+  // them have been added
+  unsigned threshold = pts.nodes.size() + 64;
+  collapseDense(pts);
+
+  SparseBits delta;
+  std::vector<unsigned> wave;
+  while (!pts.worklist.empty()) {
+    if (pts.edgesSinceCollapse > threshold)
+      collapseDense(pts);
+    wave.swap(pts.worklist);
+    pts.worklist.clear();
+    std::sort(wave.begin(), wave.end(), [&](unsigned a, unsigned b) {
+      return pts.rank[a] > pts.rank[b];
+    });
+    for (unsigned n : wave) {
+      pts.inWL[n] = 0;
+      if (pts.parent[n] != n)
+        continue;
+
+      delta.clear();
+      delta.swap(pts.pending[n]);
+      delta.subtract(pts.pt[n]);
+      if (delta.empty())
+        continue;
+      pts.pt[n].unionWith(delta);
+
+      forEachCopy(n, pts, [&](unsigned t) {
+        t = findRep(t, pts);
+        if (t == n)
+          pts.stats.skipped++;
+        else
+          sendDense(t, delta, pts);
+      });
+
+      // *m = y adds y -> o, y = *m adds o -> y, for every new object o of n
+      // and every member m of n
+      delta.forEach([&](size_t obj) {
+        unsigned o = pts.objects[obj];
+        unsigned m = n;
+        do {
+          for (unsigned i = pts.storeBegin[m]; i < pts.storeBegin[m + 1]; ++i) {
+            addEdgeDense(pts.stores[i], o, pts);
+          }
+          for (unsigned i = pts.loadBegin[m]; i < pts.loadBegin[m + 1]; ++i) {
+            addEdgeDense(o, pts.loads[i], pts);
+          }
+          m = pts.nextMember[m];
+        } while (m != n);
+      });
+    }
+  }
+}
+
+#ifdef VERIFY_PASSES
+void verifyDense(Function &func, DensePoints2 &pts) {
   LocalData localdata;
   initialize(func, localdata);
   solve(localdata);
+  bool same = true;
+  for (unsigned n = 0; n < pts.nodes.size(); ++n) {
+    auto &expected = localdata.pt[pts.nodes[n]];
+    auto &actual = pts.pt[findRep(n, pts)];
+    same &= actual.count() == expected.size();
+    for (Value *obj : expected) {
+      auto o = std::find(pts.objects.begin(), pts.objects.end(),
+                         pts.nodeIds[obj]);
+      same &= o != pts.objects.end() && actual.test(o - pts.objects.begin());
+    }
+  }
+  if (!same)
+    errs() << "points-to: mismatch in " << func.getName() << "\n";
+}
+#endif
+
+void storePoints2(Function &func, ResultStore &results, LocalData &localdata) {
+  FrozenSets sets;
+  for (auto &[val, pt] : localdata.pt) {
+    if (!pt.empty())
+      sets.add(val, pt);
+  }
+  results.put(func, ResultKind::Points2, std::move(sets));
+}
+
+void storePoints2Dense(Function &func, ResultStore &results,
+                       DensePoints2 &pts) {
+  FrozenSets sets;
+  std::vector<Value *> set;
+  for (unsigned n = 0; n < pts.nodes.size(); ++n) {
+    set.clear();
+    pts.pt[findRep(n, pts)].forEach(
+        [&](size_t obj) { set.push_back(pts.nodes[pts.objects[obj]]); });
+    if (!set.empty())
+      sets.add(pts.nodes[n], set);
+  }
+  results.put(func, ResultKind::Points2, std::move(sets));
+}
+
+// Unification variant (Steensgaard) over the Dense engine's nodes and
+// objects. Every constraint joins classes once, in a single pass over the
+// instructions: pts(x) is the objects in x's pointee class, an object o
+// starts out pointing to itself, a copy joins the pointees of both sides,
+// and a load or store joins one side's pointee with the pointee of the
+// other's pointee. Its sets include every set of the inclusion engines.
+struct UnifiedPoints2 {
+  std::vector<Value *> nodes;
+  DenseMap<Value *, unsigned> nodeIds;
+  std::vector<unsigned> objects; // object id -> node id
+  PointeeClasses classes{0};
+};
+
+void solveUnified(Function &func, UnifiedPoints2 &pts) {
+  auto number = [&](Value *val) {
+    pts.nodeIds[val] = pts.nodes.size();
+    pts.nodes.push_back(val);
+  };
+  for (auto &arg : func.args()) {
+    number(&arg);
+  }
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (!inst.getType()->isVoidTy())
+        number(&inst);
+    }
+  }
+  auto id = [&](Value *val) -> int {
+    if (!isa<Instruction>(val) && !isa<Argument>(val))
+      return -1;
+    auto it = pts.nodeIds.find(val);
+    return it == pts.nodeIds.end() ? -1 : (int)it->second;
+  };
+
+  auto &classes = pts.classes;
+  classes = PointeeClasses(pts.nodes.size());
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (isa<AllocaInst>(inst) || isa<GetElementPtrInst>(inst)) {
+        unsigned n = pts.nodeIds[&inst];
+        pts.objects.push_back(n);
+        classes.join(classes.pointeeOf(n), n);
+
+      } else if (isa<PHINode>(inst) || isa<SelectInst>(inst) ||
+                 isa<CastInst>(inst)) {
+        unsigned n = pts.nodeIds[&inst];
+        // a select's condition is not copied
+        unsigned first = isa<SelectInst>(inst) ? 1 : 0;
+        for (unsigned i = first; i < inst.getNumOperands(); ++i) {
+          int src = id(inst.getOperand(i));
+          if (src >= 0)
+            classes.join(classes.pointeeOf(n), classes.pointeeOf(src));
+        }
+
+      } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
+        int ptr = id(load->getPointerOperand());
+        if (ptr >= 0)
+          classes.join(classes.pointeeOf(pts.nodeIds[load]),
+                       classes.pointeeOf(classes.pointeeOf(ptr)));
+
+      } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+        int ptr = id(store->getPointerOperand());
+        int val = id(store->getValueOperand());
+        if (ptr >= 0 && val >= 0)
+          classes.join(classes.pointeeOf(classes.pointeeOf(ptr)),
+                       classes.pointeeOf(val));
+      }
+    }
+  }
+}
+
+#ifdef VERIFY_PASSES
+void verifyUnified(Function &func, UnifiedPoints2 &pts) {
+  LocalData localdata;
+  initialize(func, localdata);
+  solve(localdata);
+  bool covered = true;
+  for (unsigned n = 0; n < pts.nodes.size(); ++n) {
+    int target = pts.classes.pointeeClass(n);
+    for (Value *obj : localdata.pt[pts.nodes[n]]) {
+      covered &= target >= 0 &&
+                 pts.classes.find(pts.nodeIds[obj]) == unsigned(target);
+    }
+  }
+  if (!covered)
+    errs() << "points-to-steens: misses inclusion sets in " << func.getName()
+           << "\n";
+}
+#endif
+
+void storePoints2Unified(Function &func, ResultStore &results,
+                         UnifiedPoints2 &pts) {
+  DenseMap<unsigned, std::vector<Value *>> members;
+  for (unsigned o : pts.objects) {
+    members[pts.classes.find(o)].push_back(pts.nodes[o]);
+  }
+  FrozenSets sets;
+  for (unsigned n = 0; n < pts.nodes.size(); ++n) {
+    int target = pts.classes.pointeeClass(n);
+    auto it = target < 0 ? members.end() : members.find(target);
+    if (it != members.end())
+      sets.add(pts.nodes[n], it->second);
+  }
+  results.put(func, ResultKind::Points2, std::move(sets));
+}
+
+#ifdef PRINT_STATS
+Points2Analysis::~Points2Analysis() {
+  if (engine != Points2Engine::Sparse)
+    return;
+  outs() << "\t" << name() << ": collapsed " << collapsed << " nodes in "
+         << cycles << " cycles, skipped " << skipped << " propagations\n";
+}
+#endif
+
+ArrayRef<ResultKind> Points2Analysis::resultKinds() const {
+  static const ResultKind kinds[] = {ResultKind::Points2};
+  return kinds;
+}
+
+std::string Points2Analysis::name() const {
+  switch (engine) {
+  case Points2Engine::Set:
+    return "points-to-set";
+  case Points2Engine::Unification:
+    return "points-to-steens";
+  default:
+    return "points-to";
+  }
+}
+
+void Points2Analysis::run(Function &func) {
+  switch (engine) {
+  case Points2Engine::Set: {
+    LocalData localdata;
+    initialize(func, localdata);
+    solve(localdata);
+    if (results && results->covers(func))
+      storePoints2(func, *results, localdata);
+    break;
+  }
+  case Points2Engine::Unification: {
+    UnifiedPoints2 pts;
+    solveUnified(func, pts);
+#ifdef VERIFY_PASSES
+    verifyUnified(func, pts);
+#endif
+    if (results && results->covers(func))
+      storePoints2Unified(func, *results, pts);
+    break;
+  }
+  default: {
+    DensePoints2 pts;
+    initializeDense(func, pts);
+    solveDense(pts);
+#ifdef VERIFY_PASSES
+    verifyDense(func, pts);
+#endif
+    if (results && results->covers(func))
+      storePoints2Dense(func, *results, pts);
+#ifdef PRINT_STATS
+    collapsed += pts.stats.collapsed;
+    cycles += pts.stats.cycles;
+    skipped += pts.stats.skipped;
+#endif
+    break;
+  }
+  }
 }
@@ -0,0 +1,357 @@
+#include "resultfile.hpp"
+#include "cache.hpp"
+
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Errc.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+using namespace resultfile;
+
+ResultFileWriter::ResultFileWriter(const Module &module) : module(module) {
+  for (auto &global : module.global_values()) {
+    if (!global.hasName()) {
+      valueRef(&global);
+      continue;
+    }
+    valueIds[&global] = values.size();
+    values.push_back({addString(global.getName()), global.getName().size()});
+  }
+  for (auto &func : module) {
+    if (func.isDeclaration())
+      continue;
+    FuncEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.nameOffset = addString(func.getName());
+    entry.nameLength = func.getName().size();
+    entry.args = func.arg_size();
+    entry.blocks = func.size();
+    entry.insts = func.getInstructionCount();
+    funcIds[&func] = funcs.size();
+    funcs.push_back(entry);
+  }
+  added.assign(funcs.size(), false);
+}
+
+uint32_t ResultFileWriter::addString(StringRef str) {
+  uint32_t offset = strings.size();
+  strings.append(str.begin(), str.end());
+  return offset;
+}
+
+uint32_t ResultFileWriter::valueRef(const Value *val) {
+  auto it = valueIds.find(val);
+  if (it != valueIds.end())
+    return ModuleRef | it->second;
+  uint32_t id = values.size();
+  valueIds[val] = id;
+  const Function *func = nullptr;
+  if (auto *arg = dyn_cast<Argument>(val))
+    func = arg->getParent();
+  else if (auto *inst = dyn_cast<Instruction>(val))
+    func = inst->getFunction();
+  else if (auto *BB = dyn_cast<BasicBlock>(val))
+    func = BB->getParent();
+  auto owner = func ? funcIds.find(func) : funcIds.end();
+  if (owner != funcIds.end()) {
+    auto &ids = positions[func];
+    if (ids.empty())
+      numberLocals(*func, ids);
+    values.push_back({LocalOf | owner->second, ids.lookup(val)});
+    return ModuleRef | id;
+  }
+  std::string name;
+  raw_string_ostream os(name);
+  val->printAsOperand(os, !isa<GlobalValue>(val), &module);
+  os.flush();
+  values.push_back({addString(name), name.size()});
+  return ModuleRef | id;
+}
+
+bool ResultFileWriter::open(const std::string &filename) {
+  std::error_code EC;
+  out = std::make_unique<raw_fd_ostream>(filename, EC);
+  if (EC || !out->supportsSeeking()) {
+    errs() << "Cannot write result file " << filename << ": "
+           << (EC ? EC.message() : "not seekable") << "\n";
+    out.reset();
+    return false;
+  }
+  // patched by finish()
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  out->write(reinterpret_cast<const char *>(&header), sizeof(header));
+  return true;
+}
+
+void ResultFileWriter::add(const Function &func, const ResultStore &results) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = funcIds.find(&func);
+  if (!out || it == funcIds.end() || added[it->second])
+    return;
+  added[it->second] = true;
+
+  DenseMap<const Value *, unsigned> ids;
+  numberLocals(func, ids);
+  auto ref = [&](const Value *val) {
+    auto local = ids.find(val);
+    return local != ids.end() ? local->second : valueRef(val);
+  };
+
+  support::endian::Writer writer(*out, support::little);
+  std::vector<std::pair<uint32_t, ArrayRef<const Value *>>> sets;
+  std::vector<uint32_t> items;
+  for (int kind = 0; kind < NumResultKinds; ++kind) {
+    auto *frozen = results.get(func, ResultKind(kind));
+    if (!frozen)
+      continue;
+    sets.clear();
+    frozen->forEach([&](const Value *key, ArrayRef<const Value *> set) {
+      sets.push_back({ref(key), set});
+    });
+    std::sort(sets.begin(), sets.end(),
+              [](auto &a, auto &b) { return a.first < b.first; });
+
+    items.clear();
+    std::vector<uint32_t> begin = {0};
+    for (auto &[key, set] : sets) {
+      size_t first = items.size();
+      for (auto *val : set) {
+        items.push_back(ref(val));
+      }
+      std::sort(items.begin() + first, items.end());
+      begin.push_back(items.size());
+    }
+
+    funcs[it->second].sets[kind] = out->tell();
+    writer.write<uint32_t>(sets.size());
+    writer.write<uint32_t>(items.size());
+    for (auto &[key, set] : sets) {
+      writer.write<uint32_t>(key);
+    }
+    writer.write<uint32_t>(begin);
+    writer.write<uint32_t>(items);
+  }
+}
+
+bool ResultFileWriter::finish(const ResultStore &results) {
+  if (!out)
+    return false;
+  for (auto &func : module) {
+    add(func, results);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  support::endian::Writer writer(*out, support::little);
+  std::vector<Section> sections;
+  auto section = [&](SectionId id, uint64_t offset) {
+    Section entry;
+    entry.id = id;
+    entry.zero = 0;
+    entry.offset = offset;
+    entry.size = out->tell() - offset;
+    sections.push_back(entry);
+  };
+  auto align = [&](unsigned to) {
+    while (out->tell() % to) {
+      writer.write<uint8_t>(0);
+    }
+  };
+
+  section(Sets, sizeof(Header));
+  uint64_t offset = out->tell();
+  *out << strings;
+  section(Strings, offset);
+
+  align(4);
+  offset = out->tell();
+  for (auto &[name, length] : values) {
+    writer.write<uint32_t>(name);
+    writer.write<uint32_t>(length);
+  }
+  section(Values, offset);
+
+  align(8);
+  offset = out->tell();
+  out->write(reinterpret_cast<const char *>(funcs.data()),
+             funcs.size() * sizeof(FuncEntry));
+  section(Functions, offset);
+
+  std::vector<uint32_t> names(funcs.size());
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    names[i] = i;
+  }
+  auto name = [&](uint32_t i) {
+    return StringRef(strings).substr(funcs[i].nameOffset, funcs[i].nameLength);
+  };
+  std::sort(names.begin(), names.end(),
+            [&](uint32_t a, uint32_t b) { return name(a) < name(b); });
+  offset = out->tell();
+  writer.write<uint32_t>(names);
+  section(Names, offset);
+
+  align(8);
+  Header header;
+  std::memcpy(header.magic, Magic, sizeof(Magic));
+  header.version = Version;
+  header.sections = sections.size();
+  header.sectionTable = out->tell();
+  out->write(reinterpret_cast<const char *>(sections.data()),
+             sections.size() * sizeof(Section));
+  out->seek(0);
+  out->write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out->close();
+  bool ok = !out->has_error();
+  if (!ok) {
+    errs() << "Cannot write result file: " << out->error().message() << "\n";
+    out->clear_error();
+  }
+  out.reset();
+  return ok;
+}
+
+ArrayRef<u32> ResultTable::lookup(uint32_t key) const {
+  auto it = std::lower_bound(keys.begin(), keys.end(), key,
+                             [](const u32 &a, uint32_t b) { return a < b; });
+  if (it == keys.end() || *it != key)
+    return {};
+  return set(it - keys.begin());
+}
+
+ResultFile::ResultFile(sys::fs::mapped_file_region region)
+    : region(std::move(region)) {
+  data = StringRef(this->region.const_data(), this->region.size());
+}
+
+std::unique_ptr<ResultFile> ResultFile::open(const std::string &filename) {
+  std::error_code EC;
+  uint64_t size = 0;
+  auto fd = sys::fs::openNativeFileForRead(filename);
+  if (!fd) {
+    EC = errorToErrorCode(fd.takeError());
+  } else {
+    EC = sys::fs::file_size(filename, size);
+    if (!EC && size < sizeof(Header))
+      EC = make_error_code(errc::invalid_argument);
+  }
+  std::unique_ptr<ResultFile> file;
+  if (!EC) {
+    sys::fs::mapped_file_region region(
+        *fd, sys::fs::mapped_file_region::readonly, size, 0, EC);
+    if (!EC)
+      file.reset(new ResultFile(std::move(region)));
+  }
+  if (fd)
+    sys::fs::closeFile(*fd);
+  if (!EC && !file->parse())
+    EC = make_error_code(errc::invalid_argument);
+  if (EC) {
+    errs() << "Cannot read result file " << filename << ": " << EC.message()
+           << "\n";
+    return nullptr;
+  }
+  return file;
+}
+
+bool ResultFile::parse() {
+  auto *header = reinterpret_cast<const Header *>(data.data());
+  if (std::memcmp(header->magic, Magic, sizeof(Magic)) ||
+      header->version != Version || header->sectionTable > data.size() ||
+      (data.size() - header->sectionTable) / sizeof(Section) <
+          header->sections)
+    return false;
+  ArrayRef<Section> sections(
+      reinterpret_cast<const Section *>(data.data() + header->sectionTable),
+      header->sections);
+  for (auto &section : sections) {
+    if (section.offset > data.size() ||
+        section.size > data.size() - section.offset)
+      return false;
+    const char *begin = data.data() + section.offset;
+    switch (section.id) {
+    case Strings:
+      strings = StringRef(begin, section.size);
+      break;
+    case Values:
+      values = makeArrayRef(reinterpret_cast<const u32 *>(begin),
+                            section.size / sizeof(u32));
+      break;
+    case Functions:
+      funcs = makeArrayRef(reinterpret_cast<const FuncEntry *>(begin),
+                           section.size / sizeof(FuncEntry));
+      break;
+    case Names:
+      names = makeArrayRef(reinterpret_cast<const u32 *>(begin),
+                           section.size / sizeof(u32));
+      break;
+    default:
+      break;
+    }
+  }
+  if (names.size() != funcs.size())
+    return false;
+  for (auto &func : funcs) {
+    if (func.nameOffset > strings.size() ||
+        func.nameLength > strings.size() - func.nameOffset)
+      return false;
+  }
+  for (uint32_t i : names) {
+    if (i >= funcs.size())
+      return false;
+  }
+  return true;
+}
+
+StringRef ResultFile::functionName(size_t func) const {
+  return strings.substr(funcs[func].nameOffset, funcs[func].nameLength);
+}
+
+size_t ResultFile::find(StringRef name) const {
+  auto it = std::lower_bound(names.begin(), names.end(), name,
+                             [&](const u32 &i, StringRef name) {
+                               return functionName(i) < name;
+                             });
+  if (it == names.end() || functionName(*it) != name)
+    return funcs.size();
+  return *it;
+}
+
+ResultTable ResultFile::sets(size_t func, ResultKind kind) const {
+  uint64_t offset = funcs[func].sets[int(kind)];
+  if (!offset || offset > data.size() || data.size() - offset < 8)
+    return {};
+  auto *words = reinterpret_cast<const u32 *>(data.data() + offset);
+  uint64_t nkeys = words[0], nitems = words[1];
+  if ((data.size() - offset) / sizeof(u32) < 2 + 2 * nkeys + 1 + nitems)
+    return {};
+  ArrayRef<u32> keys(words + 2, nkeys);
+  ArrayRef<u32> begin(keys.end(), nkeys + 1);
+  ArrayRef<u32> items(begin.end(), nitems);
+  for (size_t i = 0; i < nkeys; ++i) {
+    if (begin[i] > begin[i + 1])
+      return {};
+  }
+  if (begin[0] != 0 || begin[nkeys] != nitems)
+    return {};
+  return ResultTable(keys, begin, items);
+}
+
+StringRef ResultFile::valueName(uint32_t ref) const {
+  size_t i = 2 * size_t(ref & ~ModuleRef);
+  if (!(ref & ModuleRef) || i + 1 >= values.size() ||
+      (values[i] & LocalOf) || values[i] > strings.size())
+    return {};
+  return strings.substr(values[i], values[i + 1]);
+}
+
+bool ResultFile::valueLocal(uint32_t ref, size_t &func,
+                            uint32_t &local) const {
+  size_t i = 2 * size_t(ref & ~ModuleRef);
+  if (!(ref & ModuleRef) || i + 1 >= values.size() || !(values[i] & LocalOf))
+    return false;
+  func = values[i] & ~LocalOf;
+  local = values[i + 1];
+  return func < funcs.size();
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "results.hpp"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Result file layout, every field little-endian:
+//   header: "PASSRES\0", u32 version, u32 sections, u64 section table offset
+//   sets: set tables, appended as functions complete
+//   strings: names of functions and module values
+//   values: per module value u32 name offset, u32 name length, or
+//     LocalOf | u32 function index, u32 local index
+//   functions: one FuncEntry per defined function, in module order
+//   names: u32 function indices sorted by name
+//   section table: per section u32 id, u32 zero, u64 offset, u64 size
+// A set table is u32 keys, u32 items, the sorted key refs, u32 begin per
+// key plus one, and the items, each set sorted. A ref below ModuleRef is a
+// position among the function's locals (arguments, then blocks, then
+// instructions); ModuleRef | i is the i-th module value: globals by name,
+// locals of other functions (e.g. module points-to objects) by function and
+// position, anything else by its printed form.
+namespace resultfile {
+using u32 = llvm::support::ulittle32_t;
+using u64 = llvm::support::ulittle64_t;
+
+constexpr char Magic[8] = {'P', 'A', 'S', 'S', 'R', 'E', 'S', '\0'};
+// 2: ModulePoints2 sets
+// 3: other functions' locals by position
+constexpr uint32_t Version = 3;
+constexpr uint32_t ModuleRef = 0x80000000;
+constexpr uint32_t LocalOf = 0x80000000;
+
+enum SectionId : uint32_t { Sets = 1, Strings, Values, Functions, Names };
+
+struct Header {
+  char magic[8];
+  u32 version;
+  u32 sections;
+  u64 sectionTable;
+};
+
+struct Section {
+  u32 id;
+  u32 zero;
+  u64 offset;
+  u64 size;
+};
+
+struct FuncEntry {
+  u32 nameOffset;
+  u32 nameLength;
+  u32 args;
+  u32 blocks;
+  u32 insts;
+  u32 zero;
+  // file offset of the set table per ResultKind, 0 if none
+  u64 sets[NumResultKinds];
+};
+} // namespace resultfile
+
+// Streams the results of one module into a result file. add() may be called
+// from any thread as soon as a function's results are complete, e.g. from
+// ResultStore::onComplete; finish() adds the functions that never were and
+// writes the tables that need all of them.
+class ResultFileWriter {
+private:
+  const llvm::Module &module;
+  std::unique_ptr<llvm::raw_fd_ostream> out;
+  std::mutex lock;
+  std::string strings;
+  // module values; globals numbered up front, the rest on first use
+  llvm::DenseMap<const llvm::Value *, uint32_t> valueIds;
+  std::vector<std::pair<uint32_t, uint32_t>> values;
+  llvm::DenseMap<const llvm::Function *, unsigned> funcIds;
+  std::vector<resultfile::FuncEntry> funcs;
+  std::vector<bool> added;
+  // locals of the functions whose values went into the value table
+  llvm::DenseMap<const llvm::Function *,
+                 llvm::DenseMap<const llvm::Value *, unsigned>>
+      positions;
+
+  uint32_t addString(llvm::StringRef str);
+  uint32_t valueRef(const llvm::Value *val);
+
+public:
+  explicit ResultFileWriter(const llvm::Module &module);
+  // false, with a message, if filename cannot be written
+  bool open(const std::string &filename);
+  // Every kind results holds for func; later calls for func are ignored.
+  void add(const llvm::Function &func, const ResultStore &results);
+  bool finish(const ResultStore &results);
+};
+
+// One function's sets of one kind, read in place from the mapped file.
+class ResultTable {
+private:
+  llvm::ArrayRef<resultfile::u32> keys, begin, items;
+
+public:
+  ResultTable() = default;
+  ResultTable(llvm::ArrayRef<resultfile::u32> keys,
+              llvm::ArrayRef<resultfile::u32> begin,
+              llvm::ArrayRef<resultfile::u32> items)
+      : keys(keys), begin(begin), items(items) {}
+
+  size_t size() const { return keys.size(); }
+  uint32_t key(size_t i) const { return keys[i]; }
+  llvm::ArrayRef<resultfile::u32> set(size_t i) const {
+    return items.slice(begin[i], begin[i + 1] - begin[i]);
+  }
+  // empty for keys without a set
+  llvm::ArrayRef<resultfile::u32> lookup(uint32_t key) const;
+};
+
+// A result file mapped read-only. Accessors return views into the mapping,
+// valid as long as the ResultFile.
+class ResultFile {
+private:
+  llvm::sys::fs::mapped_file_region region;
+  llvm::StringRef data;
+  llvm::StringRef strings;
+  llvm::ArrayRef<resultfile::u32> values;
+  llvm::ArrayRef<resultfile::FuncEntry> funcs;
+  llvm::ArrayRef<resultfile::u32> names;
+
+  explicit ResultFile(llvm::sys::fs::mapped_file_region region);
+  bool parse();
+
+public:
+  // nullptr, with a message, if filename is missing or not a result file
+  static std::unique_ptr<ResultFile> open(const std::string &filename);
+
+  size_t functions() const { return funcs.size(); }
+  llvm::StringRef functionName(size_t func) const;
+  const resultfile::FuncEntry &function(size_t func) const {
+    return funcs[func];
+  }
+  // functions() if there is none
+  size_t find(llvm::StringRef name) const;
+  // empty if the function has no sets of kind
+  ResultTable sets(size_t func, ResultKind kind) const;
+  // name of a ref at or above ModuleRef, empty for locals
+  llvm::StringRef valueName(uint32_t ref) const;
+  // whether a ref at or above ModuleRef is a local of a function, and
+  // which one and where
+  bool valueLocal(uint32_t ref, size_t &func, uint32_t &local) const;
+};
@@ -0,0 +1,121 @@
+#include "results.hpp"
+
+#include "llvm/IR/Argument.h"
+#include "llvm/IR/Instruction.h"
+
+using namespace llvm;
+
+size_t FrozenSets::bytes() const {
+  return index.getMemorySize() + begin.capacity() * sizeof(unsigned) +
+         items.capacity() * sizeof(const Value *);
+}
+
+ResultStore::ResultStore(const Module &module) : module(&module) {
+  for (auto &func : module) {
+    unsigned id = funcIds.size();
+    funcIds[&func] = id;
+  }
+  slots.reset(new Slot[funcIds.size()]);
+}
+
+ResultStore::~ResultStore() {
+  for (unsigned i = 0; i < funcIds.size(); ++i) {
+    for (auto &sets : slots[i].sets) {
+      delete sets.load();
+    }
+  }
+}
+
+void ResultStore::put(const Function &func, ResultKind kind, FrozenSets sets) {
+  auto it = funcIds.find(&func);
+  if (it == funcIds.end())
+    return;
+  auto *frozen = new FrozenSets(std::move(sets));
+  Slot &slot = slots[it->second];
+  delete slot.sets[int(kind)].exchange(frozen, std::memory_order_acq_rel);
+  if (expected[int(kind)] &&
+      slot.missing.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    completed(func);
+}
+
+void ResultStore::onComplete(ArrayRef<ResultKind> kinds,
+                             std::function<void(const Function &)> done) {
+  expected.fill(0);
+  for (ResultKind kind : kinds) {
+    expected[int(kind)]++;
+  }
+  completed = std::move(done);
+  for (unsigned i = 0; i < funcIds.size(); ++i) {
+    slots[i].missing = kinds.size();
+  }
+}
+
+const FrozenSets *ResultStore::find(const Function *func,
+                                    ResultKind kind) const {
+  auto it = funcIds.find(func);
+  if (it == funcIds.end())
+    return nullptr;
+  return slots[it->second].sets[int(kind)].load(std::memory_order_acquire);
+}
+
+ArrayRef<const Value *> ResultStore::liveIn(const BasicBlock &BB) const {
+  auto *sets = find(BB.getParent(), ResultKind::LiveIn);
+  return sets ? sets->lookup(&BB) : ArrayRef<const Value *>();
+}
+
+ArrayRef<const Value *> ResultStore::liveOut(const BasicBlock &BB) const {
+  auto *sets = find(BB.getParent(), ResultKind::LiveOut);
+  return sets ? sets->lookup(&BB) : ArrayRef<const Value *>();
+}
+
+// the function whose sets hold val's, if any
+const Function *valueFunction(const Value &val) {
+  if (auto *inst = dyn_cast<Instruction>(&val))
+    return inst->getFunction();
+  if (auto *arg = dyn_cast<Argument>(&val))
+    return arg->getParent();
+  return nullptr;
+}
+
+ArrayRef<const Value *> ResultStore::points2(const Value &val) const {
+  auto *func = valueFunction(val);
+  auto *sets = func ? find(func, ResultKind::Points2) : nullptr;
+  return sets ? sets->lookup(&val) : ArrayRef<const Value *>();
+}
+
+ArrayRef<const Value *> ResultStore::callees(const CallBase &call) const {
+  auto *sets = find(call.getFunction(), ResultKind::Callees);
+  return sets ? sets->lookup(&call) : ArrayRef<const Value *>();
+}
+
+ArrayRef<const Value *> ResultStore::slice(const Value &root) const {
+  auto *func = valueFunction(root);
+  auto *sets = func ? find(func, ResultKind::Slices) : nullptr;
+  return sets ? sets->lookup(&root) : ArrayRef<const Value *>();
+}
+
+ArrayRef<const Value *> ResultStore::modulePoints2(const Value &val) const {
+  auto *func = valueFunction(val);
+  auto *sets = func ? find(func, ResultKind::ModulePoints2) : nullptr;
+  return sets ? sets->lookup(&val) : ArrayRef<const Value *>();
+}
+
+size_t ResultStore::count(ResultKind kind) const {
+  size_t count = 0;
+  for (unsigned i = 0; i < funcIds.size(); ++i) {
+    if (auto *sets = slots[i].sets[int(kind)].load(std::memory_order_acquire))
+      count += sets->size();
+  }
+  return count;
+}
+
+size_t ResultStore::bytes() const {
+  size_t bytes = 0;
+  for (unsigned i = 0; i < funcIds.size(); ++i) {
+    for (auto &sets : slots[i].sets) {
+      if (auto *frozen = sets.load(std::memory_order_acquire))
+        bytes += frozen->bytes();
+    }
+  }
+  return bytes;
+}
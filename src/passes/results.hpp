@@ -0,0 +1,119 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Value.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Sets of values keyed by an IR object (block, value or call), built once
+// and read-only afterwards. Every set is a sorted slice of one flat array.
+class FrozenSets {
+private:
+  llvm::DenseMap<const llvm::Value *, unsigned> index;
+  std::vector<unsigned> begin = {0};
+  std::vector<const llvm::Value *> items;
+
+public:
+  template <typename Range> void add(const llvm::Value *key, const Range &set) {
+    index[key] = begin.size() - 1;
+    items.insert(items.end(), set.begin(), set.end());
+    std::sort(items.begin() + begin.back(), items.end());
+    begin.push_back(items.size());
+  }
+
+  // empty for keys that were never added
+  llvm::ArrayRef<const llvm::Value *> lookup(const llvm::Value *key) const {
+    auto it = index.find(key);
+    if (it == index.end())
+      return {};
+    unsigned i = it->second;
+    return llvm::makeArrayRef(items.data() + begin[i], begin[i + 1] - begin[i]);
+  }
+  bool contains(const llvm::Value *key, const llvm::Value *val) const {
+    auto set = lookup(key);
+    return std::binary_search(set.begin(), set.end(), val);
+  }
+  // f(key, set) for every key, in no particular order
+  template <typename F> void forEach(F f) const {
+    for (auto &[key, i] : index) {
+      f(key, llvm::makeArrayRef(items.data() + begin[i],
+                                begin[i + 1] - begin[i]));
+    }
+  }
+  size_t size() const { return begin.size() - 1; }
+  size_t bytes() const;
+};
+
+enum class ResultKind {
+  LiveIn,
+  LiveOut,
+  Points2,
+  Callees,
+  Slices,
+  ModulePoints2
+};
+constexpr int NumResultKinds = 6;
+
+// Results of the passes on the functions of one module. Every function has
+// its own slot, created up front, so writers from parallel schedulers only
+// swap an atomic pointer and never take a lock. Writes for functions of any
+// other module (e.g. the clones ConcurrentModules analyzes) are dropped.
+// Queries must not race with a write of the same function and kind.
+class ResultStore {
+private:
+  struct Slot {
+    std::array<std::atomic<const FrozenSets *>, NumResultKinds> sets{};
+    // expected puts not made yet
+    std::atomic<unsigned> missing{0};
+  };
+  const llvm::Module *module;
+  llvm::DenseMap<const llvm::Function *, unsigned> funcIds;
+  std::unique_ptr<Slot[]> slots;
+  // puts expected per kind, one per pass that writes it
+  std::array<unsigned, NumResultKinds> expected{};
+  std::function<void(const llvm::Function &)> completed;
+
+  const FrozenSets *find(const llvm::Function *func, ResultKind kind) const;
+
+public:
+  explicit ResultStore(const llvm::Module &module);
+  ~ResultStore();
+  ResultStore(const ResultStore &) = delete;
+  ResultStore &operator=(const ResultStore &) = delete;
+
+  bool covers(const llvm::Function &func) const {
+    return func.getParent() == module;
+  }
+  void put(const llvm::Function &func, ResultKind kind, FrozenSets sets);
+  // Call done(func) on the putting thread as soon as func has every kind
+  // in kinds. A kind listed once per pass writing it waits for all of
+  // them, so no later put replaces sets done() reads. Set before the first
+  // put.
+  void onComplete(llvm::ArrayRef<ResultKind> kinds,
+                  std::function<void(const llvm::Function &)> done);
+  const FrozenSets *get(const llvm::Function &func, ResultKind kind) const {
+    return find(&func, kind);
+  }
+
+  // empty if the pass did not run on the function
+  llvm::ArrayRef<const llvm::Value *> liveIn(const llvm::BasicBlock &BB) const;
+  llvm::ArrayRef<const llvm::Value *> liveOut(const llvm::BasicBlock &BB) const;
+  llvm::ArrayRef<const llvm::Value *> points2(const llvm::Value &val) const;
+  llvm::ArrayRef<const llvm::Value *> callees(const llvm::CallBase &call) const;
+  llvm::ArrayRef<const llvm::Value *> slice(const llvm::Value &root) const;
+  llvm::ArrayRef<const llvm::Value *>
+  modulePoints2(const llvm::Value &val) const;
+
+  size_t count(ResultKind kind) const;
+  size_t bytes() const;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// Strongly connected components of a graph over nodes [0, succs.size()),
+// by Tarjan's algorithm with an explicit call stack. An SCC comes out only
+// after every SCC it reaches, so for a call graph callees come first.
+// sccOf maps every node to its SCC.
+inline std::vector<std::vector<unsigned>>
+findSCCs(const std::vector<std::vector<unsigned>> &succs,
+         std::vector<unsigned> &sccOf) {
+  unsigned nnodes = succs.size();
+  const unsigned none = ~0u;
+  std::vector<unsigned> index(nnodes, 0), low(nnodes), stack;
+  std::vector<std::pair<unsigned, unsigned>> calls; // node, next succ
+  std::vector<std::vector<unsigned>> sccs;
+  sccOf.assign(nnodes, none);
+  unsigned counter = 0;
+  for (unsigned root = 0; root < nnodes; ++root) {
+    if (index[root])
+      continue;
+    index[root] = low[root] = ++counter;
+    stack.push_back(root);
+    calls.push_back({root, 0});
+    while (!calls.empty()) {
+      unsigned n = calls.back().first;
+      unsigned i = calls.back().second;
+      if (i < succs[n].size()) {
+        calls.back().second++;
+        unsigned t = succs[n][i];
+        if (!index[t]) {
+          index[t] = low[t] = ++counter;
+          stack.push_back(t);
+          calls.push_back({t, 0});
+        } else if (sccOf[t] == none) {
+          low[n] = std::min(low[n], index[t]);
+        }
+        continue;
+      }
+      calls.pop_back();
+      if (!calls.empty()) {
+        unsigned caller = calls.back().first;
+        low[caller] = std::min(low[caller], low[n]);
+      }
+      if (low[n] != index[n])
+        continue;
+      sccs.emplace_back();
+      unsigned m;
+      do {
+        m = stack.back();
+        stack.pop_back();
+        sccOf[m] = sccs.size() - 1;
+        sccs.back().push_back(m);
+      } while (m != n);
+    }
+  }
+  return sccs;
+}
+
+// Hands out the nodes of a DAG to worker threads, each once every node in
+// its waitsFor list has finished. Ready nodes come highest priority first
+// (all equal if priority is empty).
+class WaveQueue {
+public:
+  WaveQueue(const std::vector<std::vector<unsigned>> &waitsFor,
+            std::vector<double> priority = {})
+      : priority(std::move(priority)), pending(waitsFor.size()),
+        dependents(waitsFor.size()), remaining(waitsFor.size()) {
+    if (this->priority.empty())
+      this->priority.assign(waitsFor.size(), 0);
+    for (unsigned n = 0; n < waitsFor.size(); ++n) {
+      pending[n] = waitsFor[n].size();
+      for (unsigned dep : waitsFor[n]) {
+        dependents[dep].push_back(n);
+      }
+      if (!pending[n])
+        ready.push({this->priority[n], n});
+    }
+  }
+
+  // Blocks until a node is ready; false once every node has finished.
+  bool take(unsigned &node) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return !ready.empty() || !remaining; });
+    if (!remaining)
+      return false;
+    node = ready.top().second;
+    ready.pop();
+    return true;
+  }
+
+  // Releases the dependents of a taken node.
+  void finish(unsigned node) {
+    std::lock_guard<std::mutex> lock(mutex);
+    remaining--;
+    for (unsigned dependent : dependents[node]) {
+      if (!--pending[dependent])
+        ready.push({priority[dependent], dependent});
+    }
+    wake.notify_all();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<double> priority;
+  std::priority_queue<std::pair<double, unsigned>> ready;
+  std::vector<unsigned> pending;
+  std::vector<std::vector<unsigned>> dependents;
+  size_t remaining;
+};
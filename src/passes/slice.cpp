@@ -1,18 +1,31 @@
 #include "passes.hpp"
+#include "bitvec.hpp"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <cmath>
+#include <deque>
+#include <memory_resource>
 #include <queue>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 using namespace llvm;
 
-void backwardSlice(Value *root, std::unordered_set<Value *> &slice) {
-  std::queue<Value *> worklist;
+// slices and their worklists live in the task arena
+using ValueSet = std::pmr::unordered_set<Value *>;
+using ValueQueue = std::queue<Value *, std::pmr::deque<Value *>>;
+
+void backwardSlice(Value *root, ValueSet &slice) {
+  ValueQueue worklist(taskArena());
 
   auto add2Slice = [&](Value *i) {
     if (slice.insert(i).second) {
@@ -76,8 +89,8 @@ void backwardSlice(Value *root, std::unordered_set<Value *> &slice) {
   }
 }
 
-void forwardSlice(Value *root, std::unordered_set<Value *> &slice) {
-  std::queue<Value *> worklist;
+void forwardSlice(Value *root, ValueSet &slice) {
+  ValueQueue worklist(taskArena());
 
   auto add2Slice = [&](Value *i) {
     if (slice.insert(i).second) {
@@ -98,23 +111,386 @@ void forwardSlice(Value *root, std::unordered_set<Value *> &slice) {
   }
 }
 
-void sliceFunc(Function &func) {
+// GEPs are sliced backward and forward, allocas and arguments forward.
+// The forward walk of a GEP gets its own set, so that it does not stop at
+// values the backward walk found and the slice is backward + forward like
+// the condensed engine's, whether or not it goes into sets.
+void sliceRoot(Value *root, FrozenSets *sets) {
+  ValueSet slice(taskArena());
+  if (isa<GetElementPtrInst>(root)) {
+    backwardSlice(root, slice);
+    ValueSet fwd(taskArena());
+    forwardSlice(root, fwd);
+    slice.insert(fwd.begin(), fwd.end());
+  } else {
+    forwardSlice(root, slice);
+  }
+  if (sets)
+    sets->add(root, slice);
+}
+
+void sliceRoots(Function &func, std::vector<Value *> &roots) {
   for (auto &BB : func) {
     for (auto &inst : BB) {
-      if (isa<GetElementPtrInst>(inst)) {
-        std::unordered_set<Value *> slice;
-        backwardSlice(&inst, slice);
-        forwardSlice(&inst, slice);
-      } else if (isa<AllocaInst>(inst)) {
-        std::unordered_set<Value *> slice;
-        forwardSlice(&inst, slice);
+      if (isa<GetElementPtrInst>(inst) || isa<AllocaInst>(inst))
+        roots.push_back(&inst);
+    }
+  }
+  for (auto &arg : func.args()) {
+    roots.push_back(&arg);
+  }
+}
+
+void sliceFunc(Function &func, FrozenSets *sets = nullptr) {
+  std::vector<Value *> roots;
+  sliceRoots(func, roots);
+  for (Value *root : roots) {
+    sliceRoot(root, sets);
+  }
+}
+
+// sliceFunc with every nparts-th root in one part, so that the roots of
+// one stretch of code, which tend to cost alike, are spread over all of
+// them. Each part keeps its own sets until the join.
+class SliceSplit : public SplitTask {
+private:
+  Function &func;
+  std::shared_ptr<ResultStore> results;
+  std::vector<Value *> roots;
+  std::vector<FrozenSets> sets;
+
+public:
+  SliceSplit(Function &func, std::shared_ptr<ResultStore> results,
+             unsigned nparts)
+      : func(func), results(std::move(results)) {
+    sliceRoots(func, roots);
+    sets.resize(std::min<size_t>(nparts, roots.size()));
+  }
+  unsigned parts() const override { return sets.size(); }
+  void runPart(unsigned part) override {
+    for (size_t i = part; i < roots.size(); i += sets.size()) {
+      sliceRoot(roots[i], results ? &sets[part] : nullptr);
+    }
+  }
+  void join() override {
+    if (!results)
+      return;
+    FrozenSets all;
+    for (auto &partSets : sets) {
+      partSets.forEach([&](const Value *root, ArrayRef<const Value *> slice) {
+        all.add(root, slice);
+      });
+    }
+    results->put(func, ResultKind::Slices, std::move(all));
+  }
+};
+
+// Reachability over one edge relation between the values of a function,
+// condensed into SCCs. reach holds one bit row per SCC with every SCC
+// reachable from it, itself included, so a slice is one row lookup.
+struct Closure {
+  std::vector<unsigned> sccOf;
+  // scc -> value ids, CSR
+  std::vector<unsigned> memberBegin, members;
+  size_t nwords = 0;
+  std::vector<BitWord> reach;
+
+  const BitWord *row(unsigned scc) const { return &reach[scc * nwords]; }
+};
+
+// Closures cost nsccs^2 bits; past this many words a function is sliced by
+// traversal instead.
+constexpr size_t MaxClosureWords = size_t(1) << 23;
+
+// Values are the arguments, then the instructions. deps follows
+// backwardSlice (operands of the value plus the terminators it is control
+// dependent on), users follows forwardSlice.
+struct SliceIndex {
+  std::vector<Value *> values;
+  DenseMap<Value *, unsigned> valueIds;
+  Closure deps, users;
+
+  template <typename Fn> void forEachIn(const Closure &closure, Value *root,
+                                        Fn fn) const {
+    const BitWord *row = closure.row(closure.sccOf[valueIds.lookup(root)]);
+    bitForEach(row, closure.nwords, [&](size_t scc) {
+      for (unsigned i = closure.memberBegin[scc];
+           i < closure.memberBegin[scc + 1]; ++i) {
+        fn(values[closure.members[i]]);
       }
+    });
+  }
+};
+
+void buildEdges(std::vector<std::pair<unsigned, unsigned>> &pairs,
+                std::vector<unsigned> &begin, std::vector<unsigned> &targets,
+                unsigned nvals) {
+  begin.assign(nvals + 1, 0);
+  for (auto &[s, t] : pairs) {
+    begin[s + 1]++;
+  }
+  for (unsigned n = 0; n < nvals; ++n) {
+    begin[n + 1] += begin[n];
+  }
+  targets.resize(pairs.size());
+  std::vector<unsigned> fill(begin.begin(), begin.end() - 1);
+  for (auto &[s, t] : pairs) {
+    targets[fill[s]++] = t;
+  }
+}
+
+// Tarjan's algorithm with an explicit call stack. An SCC is emitted only
+// after every SCC it reaches, so its row is complete once it is or-ed with
+// the rows of its successors. Returns false if the rows would not fit.
+bool buildClosure(unsigned nvals,
+                  std::vector<std::pair<unsigned, unsigned>> &pairs,
+                  Closure &closure) {
+  std::vector<unsigned> begin, succs;
+  buildEdges(pairs, begin, succs, nvals);
+
+  const unsigned none = ~0u;
+  std::vector<unsigned> index(nvals, 0), low(nvals), stack;
+  std::vector<std::pair<unsigned, unsigned>> calls; // value, next succ
+  closure.sccOf.assign(nvals, none);
+  unsigned counter = 0;
+  std::vector<std::vector<unsigned>> sccs;
+  for (unsigned root = 0; root < nvals; ++root) {
+    if (index[root])
+      continue;
+    index[root] = low[root] = ++counter;
+    stack.push_back(root);
+    calls.push_back({root, begin[root]});
+    while (!calls.empty()) {
+      unsigned n = calls.back().first;
+      unsigned i = calls.back().second;
+      if (i < begin[n + 1]) {
+        calls.back().second++;
+        unsigned t = succs[i];
+        if (!index[t]) {
+          index[t] = low[t] = ++counter;
+          stack.push_back(t);
+          calls.push_back({t, begin[t]});
+        } else if (closure.sccOf[t] == none) {
+          low[n] = std::min(low[n], index[t]);
+        }
+        continue;
+      }
+      calls.pop_back();
+      if (!calls.empty()) {
+        unsigned caller = calls.back().first;
+        low[caller] = std::min(low[caller], low[n]);
+      }
+      if (low[n] != index[n])
+        continue;
+      sccs.emplace_back();
+      unsigned m;
+      do {
+        m = stack.back();
+        stack.pop_back();
+        closure.sccOf[m] = sccs.size() - 1;
+        sccs.back().push_back(m);
+      } while (m != n);
     }
   }
+
+  unsigned nsccs = sccs.size();
+  closure.nwords = bitWords(nsccs);
+  if (nsccs * closure.nwords > MaxClosureWords)
+    return false;
+  closure.reach.assign(nsccs * closure.nwords, 0);
+  closure.memberBegin.assign(1, 0);
+  closure.members.clear();
+  for (unsigned c = 0; c < nsccs; ++c) {
+    BitWord *row = &closure.reach[c * closure.nwords];
+    bitSet(row, c);
+    for (unsigned m : sccs[c]) {
+      closure.members.push_back(m);
+      for (unsigned i = begin[m]; i < begin[m + 1]; ++i) {
+        unsigned t = closure.sccOf[succs[i]];
+        if (t != c && !bitTest(row, t))
+          bitOr(row, closure.row(t), closure.nwords);
+      }
+    }
+    closure.memberBegin.push_back(closure.members.size());
+  }
+  return true;
+}
+
+bool buildSliceIndex(Function &func, SliceIndex &index) {
+  auto number = [&](Value *val) {
+    index.valueIds[val] = index.values.size();
+    index.values.push_back(val);
+  };
   for (auto &arg : func.args()) {
-    std::unordered_set<Value *> slice;
-    forwardSlice(&arg, slice);
+    number(&arg);
+  }
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      number(&inst);
+    }
   }
+
+  std::vector<std::pair<unsigned, unsigned>> deps, users;
+  for (unsigned v = 0; v < index.values.size(); ++v) {
+    Value *val = index.values[v];
+    for (auto *user : val->users()) {
+      auto it = index.valueIds.find(user);
+      if (it != index.valueIds.end())
+        users.push_back({v, it->second});
+    }
+
+    auto *inst = dyn_cast<Instruction>(val);
+    if (!inst)
+      continue;
+    auto addDep = [&](Value *dep) {
+      if (isa<Instruction>(dep))
+        deps.push_back({v, index.valueIds.lookup(dep)});
+    };
+    if (auto *phi = dyn_cast<PHINode>(inst)) {
+      for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+        addDep(phi->getIncomingValue(i));
+        addDep(phi->getIncomingBlock(i)->getTerminator());
+      }
+      continue;
+    } else if (auto *select = dyn_cast<SelectInst>(inst)) {
+      addDep(select->getTrueValue());
+      addDep(select->getFalseValue());
+    } else if (auto *cast = dyn_cast<CastInst>(inst)) {
+      addDep(cast->getOperand(0));
+    } else {
+      for (auto &use : inst->operands()) {
+        addDep(use);
+      }
+    }
+    for (BasicBlock *predBB : predecessors(inst->getParent())) {
+      addDep(predBB->getTerminator());
+    }
+  }
+
+  unsigned nvals = index.values.size();
+  return buildClosure(nvals, deps, index.deps) &&
+         buildClosure(nvals, users, index.users);
+}
+
+#ifdef VERIFY_PASSES
+// Compares against backwardSlice(root) + forwardSlice(root), each walk
+// with its own set as in sliceRoot.
+void verifySliceIndex(Function &func, SliceIndex &index) {
+  bool same = true;
+  auto check = [&](Value *root, bool backward) {
+    ValueSet expected(taskArena()), fwd(taskArena()), actual(taskArena());
+    if (backward)
+      backwardSlice(root, expected);
+    forwardSlice(root, fwd);
+    expected.insert(fwd.begin(), fwd.end());
+    if (backward)
+      index.forEachIn(index.deps, root, [&](Value *v) { actual.insert(v); });
+    index.forEachIn(index.users, root, [&](Value *v) { actual.insert(v); });
+    same &= actual == expected;
+  };
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (isa<GetElementPtrInst>(inst))
+        check(&inst, true);
+      else if (isa<AllocaInst>(inst))
+        check(&inst, false);
+    }
+  }
+  for (auto &arg : func.args()) {
+    check(&arg, false);
+  }
+  if (!same)
+    errs() << "slicing: mismatch in " << func.getName() << "\n";
 }
+#endif
 
-void Slicing::run(Function &func) { sliceFunc(func); }
\ No newline at end of file
+void storeSlices(Function &func, ResultStore &results, SliceIndex &index) {
+  FrozenSets sets;
+  std::vector<const Value *> slice;
+  auto add = [&](Value *root, bool backward) {
+    slice.clear();
+    auto collect = [&](Value *v) { slice.push_back(v); };
+    if (backward)
+      index.forEachIn(index.deps, root, collect);
+    index.forEachIn(index.users, root, collect);
+    std::sort(slice.begin(), slice.end());
+    slice.erase(std::unique(slice.begin(), slice.end()), slice.end());
+    sets.add(root, slice);
+  };
+  for (auto &BB : func) {
+    for (auto &inst : BB) {
+      if (isa<GetElementPtrInst>(inst))
+        add(&inst, true);
+      else if (isa<AllocaInst>(inst))
+        add(&inst, false);
+    }
+  }
+  for (auto &arg : func.args()) {
+    add(&arg, false);
+  }
+  results.put(func, ResultKind::Slices, std::move(sets));
+}
+
+ArrayRef<ResultKind> Slicing::resultKinds() const {
+  static const ResultKind kinds[] = {ResultKind::Slices};
+  return kinds;
+}
+
+std::string Slicing::name() const {
+  switch (engine) {
+  case SliceEngine::Traversal:
+    return "slicing-bfs";
+  default:
+    return "slicing";
+  }
+}
+
+std::unique_ptr<SplitTask> Slicing::split(Function &func, unsigned nparts) {
+  bool store = results && results->covers(func);
+  if (engine == SliceEngine::Condensed) {
+    // slices are lookups once the index is built, so only the fallback
+    // splits
+    SliceIndex index;
+    if (buildSliceIndex(func, index)) {
+#ifdef VERIFY_PASSES
+      verifySliceIndex(func, index);
+#endif
+      if (store)
+        storeSlices(func, *results, index);
+      return nullptr;
+    }
+  }
+  auto task = std::make_unique<SliceSplit>(
+      func, store ? results : nullptr, nparts);
+  if (task->parts() < 2) {
+    task->runPart(0);
+    task->join();
+    return nullptr;
+  }
+  return task;
+}
+
+void Slicing::run(Function &func) {
+  bool store = results && results->covers(func);
+  FrozenSets sets;
+  switch (engine) {
+  case SliceEngine::Traversal:
+    sliceFunc(func, store ? &sets : nullptr);
+    break;
+  default: {
+    SliceIndex index;
+    if (!buildSliceIndex(func, index)) {
+      sliceFunc(func, store ? &sets : nullptr);
+      break;
+    }
+#ifdef VERIFY_PASSES
+    verifySliceIndex(func, index);
+#endif
+    if (store)
+      storeSlices(func, *results, index);
+    return;
+  }
+  }
+  if (store)
+    results->put(func, ResultKind::Slices, std::move(sets));
+}
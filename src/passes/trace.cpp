@@ -0,0 +1,114 @@
+#include "trace.hpp"
+
+#include "llvm/IR/Function.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace llvm;
+
+std::atomic<bool> Trace::on{false};
+
+struct TraceEvent {
+  const char *category;
+  std::string name;
+  std::string func;
+  unsigned bbs;
+  uint64_t begin, end;
+};
+
+struct TraceBuffer {
+  unsigned tid;
+  std::vector<TraceEvent> events;
+};
+
+// Buffers are owned here rather than by their threads, so events of threads
+// that have exited are still written.
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  std::chrono::steady_clock::time_point epoch;
+};
+
+TraceRegistry &traceRegistry() {
+  static TraceRegistry reg;
+  return reg;
+}
+
+TraceBuffer &localBuffer() {
+  static thread_local TraceBuffer *buffer = nullptr;
+  if (!buffer) {
+    TraceRegistry &reg = traceRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.buffers.push_back(std::make_unique<TraceBuffer>());
+    buffer = reg.buffers.back().get();
+    buffer->tid = reg.buffers.size() - 1;
+  }
+  return *buffer;
+}
+
+void Trace::clear() {
+  TraceRegistry &reg = traceRegistry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (auto &buffer : reg.buffers) {
+    buffer->events.clear();
+  }
+  reg.epoch = std::chrono::steady_clock::now();
+}
+
+uint64_t Trace::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - traceRegistry().epoch)
+      .count();
+}
+
+void Trace::record(const char *category, StringRef name, uint64_t begin,
+                   uint64_t end, const Function *func) {
+  TraceBuffer &buffer = localBuffer();
+  buffer.events.push_back({category, name.str(),
+                           func ? func->getName().str() : std::string(),
+                           func ? unsigned(func->size()) : 0, begin, end});
+}
+
+bool Trace::write(const std::string &filename) {
+  std::error_code EC;
+  raw_fd_ostream out(filename, EC);
+  if (EC) {
+    errs() << "Cannot write " << filename << ": " << EC.message() << "\n";
+    return false;
+  }
+  TraceRegistry &reg = traceRegistry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  json::OStream J(out);
+  J.object([&] {
+    J.attribute("displayTimeUnit", "ns");
+    J.attributeArray("traceEvents", [&] {
+      for (auto &buffer : reg.buffers) {
+        for (auto &event : buffer->events) {
+          J.object([&] {
+            J.attribute("name", event.name);
+            J.attribute("cat", event.category);
+            J.attribute("ph", "X");
+            J.attribute("pid", 1);
+            J.attribute("tid", (int64_t)buffer->tid);
+            // trace-event timestamps are in us
+            J.attribute("ts", event.begin / 1000.0);
+            J.attribute("dur", (event.end - event.begin) / 1000.0);
+            if (!event.func.empty()) {
+              J.attributeObject("args", [&] {
+                J.attribute("func", event.func);
+                J.attribute("bbs", (int64_t)event.bbs);
+              });
+            }
+          });
+        }
+      }
+    });
+  });
+  out << "\n";
+  return true;
+}
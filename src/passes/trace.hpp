@@ -0,0 +1,64 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace llvm {
+class Function;
+}
+
+// Timeline of task and queue-wait intervals, written as Chrome trace-event
+// JSON for chrome://tracing or Perfetto. Nothing is recorded unless enabled,
+// and while off every hook costs one relaxed load. Each thread appends to its
+// own buffer, so recording only locks on a thread's first event.
+class Trace {
+private:
+  static std::atomic<bool> on;
+
+public:
+  static bool enabled() { return on.load(std::memory_order_relaxed); }
+  static void enable() { on.store(true); }
+  static void disable() { on.store(false); }
+  // Drop the events so far; timestamps count from here. Only between runs.
+  static void clear();
+
+  // ns since enable()
+  static uint64_t now();
+  // One complete event on this thread. With func, its name and BB count go
+  // into the event's args.
+  static void record(const char *category, llvm::StringRef name,
+                     uint64_t begin, uint64_t end,
+                     const llvm::Function *func = nullptr);
+
+  // Every thread's events, ordered by thread; only valid while no thread is
+  // recording.
+  static bool write(const std::string &filename);
+};
+
+// Records its own lifetime as one event when tracing is on.
+class TraceScope {
+private:
+  const char *category;
+  const char *name;
+  const llvm::Function *func;
+  uint64_t begin;
+  bool active;
+
+public:
+  TraceScope(const char *category, const char *name,
+             const llvm::Function *func = nullptr)
+      : category(category), name(name), func(func), begin(0),
+        active(Trace::enabled()) {
+    if (active)
+      begin = Trace::now();
+  }
+  ~TraceScope() {
+    if (active)
+      Trace::record(category, name, begin, Trace::now(), func);
+  }
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+};
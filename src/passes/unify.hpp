@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Steensgaard's points-to classes: union-find over dense node ids where
+// every class has at most one pointee class. Joining two classes joins
+// their pointees as well, so every constraint costs a constant number of
+// finds and joins.
+struct PointeeClasses {
+  std::vector<unsigned> parent, rank;
+  // by representative, -1 if none; may name a non-representative
+  std::vector<int> pointee;
+  std::vector<std::pair<unsigned, unsigned>> joinStack;
+  size_t joins = 0;
+
+  explicit PointeeClasses(unsigned nnodes)
+      : parent(nnodes), rank(nnodes, 0), pointee(nnodes, -1) {
+    for (unsigned n = 0; n < nnodes; ++n) {
+      parent[n] = n;
+    }
+  }
+
+  unsigned find(unsigned n) {
+    while (parent[n] != n) {
+      parent[n] = parent[parent[n]];
+      n = parent[n];
+    }
+    return n;
+  }
+
+  // -1 if n's class points nowhere yet
+  int pointeeClass(unsigned n) {
+    int p = pointee[find(n)];
+    return p < 0 ? -1 : int(find(p));
+  }
+
+  // n's pointee class, a new empty one if it has none
+  unsigned pointeeOf(unsigned n) {
+    n = find(n);
+    if (pointee[n] >= 0)
+      return find(pointee[n]);
+    unsigned p = parent.size();
+    parent.push_back(p);
+    rank.push_back(0);
+    pointee.push_back(-1);
+    pointee[n] = p;
+    return p;
+  }
+
+  void join(unsigned a, unsigned b) {
+    joinStack.push_back({a, b});
+    while (!joinStack.empty()) {
+      auto [x, y] = joinStack.back();
+      joinStack.pop_back();
+      x = find(x);
+      y = find(y);
+      if (x == y)
+        continue;
+      if (rank[x] < rank[y])
+        std::swap(x, y);
+      parent[y] = x;
+      if (rank[x] == rank[y])
+        rank[x]++;
+      joins++;
+      if (pointee[x] < 0)
+        pointee[x] = pointee[y];
+      else if (pointee[y] >= 0)
+        joinStack.push_back({unsigned(pointee[x]), unsigned(pointee[y])});
+    }
+  }
+};
@@ -8,6 +8,7 @@
 class PassMan {
 private:
   std::vector<std::shared_ptr<FuncPass>> passes;
+  std::vector<std::shared_ptr<ModulePass>> modulePasses;
 
 public:
   void setPasses(std::vector<std::shared_ptr<FuncPass>> newpasses) {
@@ -17,4 +18,19 @@ public:
   const std::vector<std::shared_ptr<FuncPass>> &getPasses() const {
     return passes;
   }
+
+  void setModulePasses(std::vector<std::shared_ptr<ModulePass>> newpasses) {
+    modulePasses = newpasses;
+  }
+
+  const std::vector<std::shared_ptr<ModulePass>> &getModulePasses() const {
+    return modulePasses;
+  }
+
+  // after the FuncPasses of a run, in order
+  void runModulePasses(llvm::Module &module) const {
+    for (auto &pass : modulePasses) {
+      pass->runTask(module);
+    }
+  }
 };
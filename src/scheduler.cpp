@@ -1,14 +1,36 @@
 #include "scheduler.hpp"
 #include "passes/passes.hpp"
-
+#include "passes/scc.hpp"
+#include "passes/trace.hpp"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <string>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <shared_mutex>
 #include <thread>
 #include <vector>
 
@@ -16,27 +38,108 @@ using namespace llvm;
 
 std::mutex outsmtx;
 
+void Scheduler::preparePasses(
+    const std::vector<std::shared_ptr<FuncPass>> &passes, Module &module,
+    unsigned nthreads) {
+  WorkerRunner runner = workerRunner();
+  for (auto pass : passes) {
+    pass->prepare(module, nthreads, runner);
+  }
+}
+
+WorkerRunner Scheduler::workerRunner() {
+  return [this](unsigned nworkers, const std::function<void(int)> &worker) {
+    runWorkers(nworkers, worker);
+  };
+}
+
+void Scheduler::runWorkers(unsigned nworkers,
+                           const std::function<void(int)> &worker) {
+  if (pool) {
+    pool->run(nworkers, worker);
+    return;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(nworkers);
+  for (unsigned i = 0; i < nworkers; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+std::vector<double>
+Scheduler::taskCosts(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                     Function &func) const {
+  if (!costModel)
+    return std::vector<double>(passes.size(), func.size());
+  auto features = FuncFeatures::of(func);
+  std::vector<double> costs;
+  for (auto pass : passes) {
+    costs.push_back(costModel->predict(pass->name(), features));
+  }
+  return costs;
+}
+
+void Scheduler::reportMakespan(const std::vector<double> &costs,
+                               unsigned nworkers, long actual) const {
+  if (!costModel)
+    return;
+  outs() << "\tPredicted makespan: " << (long)lptMakespan(costs, nworkers)
+         << " us\tActual: " << actual << " us\n";
+}
+
 void TaskTimer::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                     Module &module) {
-  std::string csvname = "tasktime.csv";
+  preparePasses(passes, module, 1);
   std::ofstream csv(csvname);
-  csv << "name,size";
+  if (!csv) {
+    errs() << "Cannot write task times to " << csvname << "\n";
+    return;
+  }
+  csv << "name";
+  for (auto feature : FuncFeatures::names) {
+    csv << "," << feature;
+  }
   for (auto pass : passes) {
     csv << "," << pass->name();
   }
+  // with counters on, a pass:counter column per pass and counter
+  const auto &counterNames = PerfCounters::names();
+  bool counted = PerfCounters::enabled() && !counterNames.empty();
+  for (auto pass : passes) {
+    for (size_t i = 0; counted && i < counterNames.size(); ++i) {
+      csv << "," << pass->name() << ":" << counterNames[i];
+    }
+  }
   csv << "\n";
 
+  std::vector<CounterValues> taskCounters(passes.size());
   for (auto &func : module) {
     if (func.isDeclaration())
       continue;
-    csv << func.getName().str() << "," << func.size();
-    for (auto pass : passes) {
+    csv << func.getName().str();
+    for (double feature : FuncFeatures::of(func).values) {
+      csv << "," << (long)feature;
+    }
+    for (size_t p = 0; p < passes.size(); ++p) {
+      CounterValues before = passes[p]->counters();
       auto start = std::chrono::high_resolution_clock::now();
-      pass->run(func);
+      passes[p]->runTask(func);
       auto end = std::chrono::high_resolution_clock::now();
       auto duration =
           std::chrono::duration_cast<std::chrono::microseconds>(end - start);
       csv << "," << duration.count();
+      CounterValues after = passes[p]->counters();
+      for (size_t i = 0; i < MaxCounters; ++i) {
+        taskCounters[p][i] = after[i] - before[i];
+      }
+    }
+    for (size_t p = 0; p < passes.size(); ++p) {
+      for (size_t i = 0; counted && i < counterNames.size(); ++i) {
+        csv << "," << taskCounters[p][i];
+      }
     }
     csv << "\n";
   }
@@ -46,10 +149,11 @@ void Sequential::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                      Module &module) {
   for (auto pass : passes) {
     auto start = std::chrono::high_resolution_clock::now();
+    pass->prepare(module, 1, workerRunner());
     for (auto &func : module) {
       if (func.isDeclaration())
         continue;
-      pass->run(func);
+      pass->runTask(func);
     }
     auto end = std::chrono::high_resolution_clock::now();
     auto duration =
@@ -64,7 +168,7 @@ void passThread(std::shared_ptr<FuncPass> pass, Module &module) {
   for (auto &func : module) {
     if (func.isDeclaration())
       continue;
-    pass->run(func);
+    pass->runTask(func);
   }
 
   auto end = std::chrono::high_resolution_clock::now();
@@ -78,14 +182,9 @@ void passThread(std::shared_ptr<FuncPass> pass, Module &module) {
 
 void ConcurrentPasses::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                            Module &module) {
-  int nthreads = passes.size();
-  std::vector<std::thread> threads;
-  for (auto pass : passes) {
-    threads.emplace_back(passThread, pass, std::ref(module));
-  }
-  for (auto &t : threads) {
-    t.join();
-  }
+  preparePasses(passes, module, passes.size());
+  runWorkers(passes.size(),
+             [&](int tid) { passThread(passes[tid], module); });
 }
 
 
@@ -93,8 +192,9 @@ struct FuncInfo {
   Function *func;
   size_t size;
   int index;
+  double cost;
 
-  bool operator<(const FuncInfo &rhs) const { return size < rhs.size; }
+  bool operator<(const FuncInfo &rhs) const { return cost < rhs.cost; }
 };
 
 void funcThread(std::vector<std::shared_ptr<FuncPass>> passes,
@@ -112,6 +212,7 @@ void funcThread(std::vector<std::shared_ptr<FuncPass>> passes,
     Function *func;
     int size;
     {
+      TraceScope wait("queue", "wait");
       std::lock_guard<std::mutex> lock(Qmutex);
       if (funcQ.empty())
         break;
@@ -125,7 +226,7 @@ void funcThread(std::vector<std::shared_ptr<FuncPass>> passes,
 #endif
 
     for (auto pass : passes) {
-      pass->run(*func);
+      pass->runTask(*func);
     }
 
 #ifdef PRINT_STATS
@@ -158,64 +259,119 @@ void funcThread(std::vector<std::shared_ptr<FuncPass>> passes,
 
 void ConcurrentFuncs::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                           Module &module) {
+  preparePasses(passes, module, nthreads);
   std::priority_queue<FuncInfo> funcQ;
+  std::vector<double> costs;
 
-  for (auto [i, func] : enumerate(module)) {
+  for (auto item : enumerate(module)) {
+    Function &func = item.value();
     if (func.isDeclaration())
       continue;
-    funcQ.push({&func, func.size(), (int)i});
+    double cost = 0;
+    for (double passCost : taskCosts(passes, func)) {
+      cost += passCost;
+    }
+    funcQ.push({&func, func.size(), (int)item.index(), cost});
+    costs.push_back(cost);
   }
 
   std::mutex Qmutex;
-  std::vector<std::thread> threads;
-  threads.reserve(nthreads);
-  for (int i = 0; i < nthreads; ++i) {
-    threads.emplace_back(funcThread, passes, std::ref(Qmutex), std::ref(funcQ),
-                         i);
-  }
-  for (auto &t : threads) {
-    t.join();
-  }
+  auto start = std::chrono::high_resolution_clock::now();
+  runWorkers(nthreads,
+             [&](int tid) { funcThread(passes, Qmutex, funcQ, tid); });
+  auto end = std::chrono::high_resolution_clock::now();
+  reportMakespan(
+      costs, nthreads,
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count());
 }
 
+// A split task and its parts not finished yet
+struct SplitJob {
+  std::unique_ptr<SplitTask> task;
+  std::atomic<unsigned> remaining{0};
+};
+
 struct TaskInfo {
   std::shared_ptr<FuncPass> pass;
   Function *func;
   size_t size;
   int index;
+  double cost;
+  // set on the parts of a split task
+  std::shared_ptr<SplitJob> job = nullptr;
+  unsigned part = 0;
+
+  bool operator<(const TaskInfo &rhs) const { return cost < rhs.cost; }
+};
 
-  bool operator<(const TaskInfo &rhs) const { return size < rhs.size; }
+// Shared by the ConcurrentTasks workers. Split tasks push their parts while
+// other workers may already be idle, so workers leave only once nothing is
+// queued or running.
+struct TaskQueue {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::priority_queue<TaskInfo> tasks;
+  // queued plus running tasks
+  size_t remaining = 0;
 };
 
-void taskThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
+void taskThread(TaskQueue &queue, unsigned splitBBs, unsigned nparts,
                 int tid) {
 #ifdef PRINT_STATS
   auto start = std::chrono::high_resolution_clock::now();
   int max_time = 0;
-  int max_size = 0;
+  size_t max_size = 0;
   int task_count = 0;
+  int split_count = 0;
 #endif
 
   while (true) {
-    int index;
-    Function *func;
-    std::shared_ptr<FuncPass> pass;
-    int size;
+    TaskInfo task;
     {
-      std::lock_guard<std::mutex> lock(Qmutex);
-      if (taskQ.empty())
+      TraceScope wait("queue", "wait");
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      queue.wake.wait(lock, [&] {
+        return !queue.tasks.empty() || !queue.remaining;
+      });
+      if (!queue.remaining)
         break;
-      index = taskQ.top().index;
-      func = taskQ.top().func;
-      pass = taskQ.top().pass;
-      size = taskQ.top().size;
-      taskQ.pop();
+      task = queue.tasks.top();
+      queue.tasks.pop();
     }
+    Function *func = task.func;
+    auto &pass = task.pass;
+    size_t size = task.size;
 #ifdef PRINT_STATS
     auto sub_start = std::chrono::high_resolution_clock::now();
 #endif
 
-    pass->run(*func);
+    if (task.job) {
+      pass->runPartTask(*task.job->task, *func, task.part);
+      if (task.job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pass->joinTask(*task.job->task, *func);
+    } else if (splitBBs && size >= splitBBs && nparts > 1) {
+      auto job = std::make_shared<SplitJob>();
+      job->task = pass->splitTask(*func, nparts);
+      if (job->task) {
+        unsigned parts = job->task->parts();
+        job->remaining = parts;
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (unsigned part = 0; part < parts; ++part) {
+          TaskInfo partTask = task;
+          partTask.job = job;
+          partTask.part = part;
+          queue.tasks.push(std::move(partTask));
+        }
+        queue.remaining += parts;
+        queue.wake.notify_all();
+#ifdef PRINT_STATS
+        split_count++;
+#endif
+      }
+    } else {
+      pass->runTask(*func);
+    }
 
 #ifdef PRINT_STATS
     auto sub_end = std::chrono::high_resolution_clock::now();
@@ -228,6 +384,10 @@ void taskThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
     }
     task_count++;
 #endif
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!--queue.remaining)
+      queue.wake.notify_all();
   }
 
 #ifdef PRINT_STATS
@@ -241,77 +401,114 @@ void taskThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
     outs() << "\t\tMax task time :\t " << max_time << " us with\t " << max_size
            << " BBs\n";
     outs() << "\t\tTasks processed:\t" << task_count << "\n";
+    outs() << "\t\tTasks split:\t" << split_count << "\n";
   }
 #endif
 }
 
 void ConcurrentTasks::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                           Module &module) {
-  std::priority_queue<TaskInfo> taskQ;
+  preparePasses(passes, module, nthreads);
+  TaskQueue queue;
+  std::vector<double> costs;
 
-  for (auto [i, func] : enumerate(module)) {
-    for (auto pass : passes) {
-      if (func.isDeclaration())
-        continue;
-      taskQ.push({pass, &func, func.size(), (int)i});
+  for (auto item : enumerate(module)) {
+    Function &func = item.value();
+    if (func.isDeclaration())
+      continue;
+    auto passCosts = taskCosts(passes, func);
+    for (auto [pass, cost] : zip(passes, passCosts)) {
+      queue.tasks.push({pass, &func, func.size(), (int)item.index(), cost});
+      costs.push_back(cost);
     }
   }
+  queue.remaining = queue.tasks.size();
 
-  std::mutex Qmutex;
-  std::vector<std::thread> threads;
-  threads.reserve(nthreads);
-  for (int i = 0; i < nthreads; ++i) {
-    threads.emplace_back(taskThread, std::ref(Qmutex), std::ref(taskQ),
-                         i);
-  }
-  for (auto &t : threads) {
-    t.join();
-  }
+  auto start = std::chrono::high_resolution_clock::now();
+  runWorkers(nthreads,
+             [&](int tid) { taskThread(queue, splitBBs, nthreads, tid); });
+  auto end = std::chrono::high_resolution_clock::now();
+  reportMakespan(
+      costs, nthreads,
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count());
 }
 
+// Each worker owns a deque. Deques are seeded round-robin from the tasks
+// sorted by size, so every deque starts with its largest task at the front.
+// Owners and thieves both take from the front: once a worker runs dry the
+// largest remaining task is the one most worth moving.
+struct TaskDeque {
+  std::mutex mutex;
+  std::deque<TaskInfo> tasks;
+};
 
-
-#include "llvm/Support/SourceMgr.h"
-#include "llvm/IRReader/IRReader.h"
-
-struct TaskMInfo {
-  std::shared_ptr<FuncPass> pass;
-  int func_idx;
-  size_t size;
-  int index;
-
-  bool operator<(const TaskInfo &rhs) const { return size < rhs.size; }
+struct alignas(64) StealStats {
+  size_t tasks = 0;
+  size_t steals = 0;
+  size_t idle = 0;
+  size_t lockWaits = 0;
 };
 
-void taskMThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
-                int tid) {
+bool takeTask(TaskDeque &dq, TaskInfo &task, StealStats &stats) {
+  if (!dq.mutex.try_lock()) {
+    stats.lockWaits++;
+    dq.mutex.lock();
+  }
+  std::lock_guard<std::mutex> lock(dq.mutex, std::adopt_lock);
+  if (dq.tasks.empty())
+    return false;
+  task = std::move(dq.tasks.front());
+  dq.tasks.pop_front();
+  return true;
+}
+
+void stealThread(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                 std::vector<TaskDeque> &deques, StealStats &stats, int tid) {
 #ifdef PRINT_STATS
   auto start = std::chrono::high_resolution_clock::now();
   int max_time = 0;
   int max_size = 0;
-  int task_count = 0;
 #endif
+  int ndeques = deques.size();
+  // one wait event from the end of a task to the start of the next,
+  // however many sweeps that takes
+  bool traced = Trace::enabled();
+  uint64_t waitBegin = traced ? Trace::now() : 0;
 
   while (true) {
-    int index;
-    Function *func;
-    std::shared_ptr<FuncPass> pass;
-    int size;
-    {
-      std::lock_guard<std::mutex> lock(Qmutex);
-      if (taskQ.empty())
-        break;
-      index = taskQ.top().index;
-      func = taskQ.top().func;
-      pass = taskQ.top().pass;
-      size = taskQ.top().size;
-      taskQ.pop();
+    TaskInfo task;
+    bool stolen = false;
+    bool found = takeTask(deques[tid], task, stats);
+    for (int i = 1; !found && i < ndeques; ++i) {
+      found = takeTask(deques[(tid + i) % ndeques], task, stats);
+      stolen = found;
     }
+    if (stolen)
+      stats.steals++;
+    if (!found) {
+      // everything is queued up front, so after an empty sweep there is
+      // nothing left to take, only the last tasks running elsewhere
+      stats.idle++;
+      break;
+    }
+    if (traced)
+      Trace::record("queue", stolen ? "steal" : "wait", waitBegin,
+                    Trace::now());
 #ifdef PRINT_STATS
     auto sub_start = std::chrono::high_resolution_clock::now();
 #endif
 
-    pass->run(*func);
+    if (task.pass) {
+      task.pass->runTask(*task.func);
+    } else {
+      for (auto pass : passes) {
+        pass->runTask(*task.func);
+      }
+    }
+    stats.tasks++;
+    if (traced)
+      waitBegin = Trace::now();
 
 #ifdef PRINT_STATS
     auto sub_end = std::chrono::high_resolution_clock::now();
@@ -320,9 +517,8 @@ void taskMThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
     int time = sub_duration.count();
     if (time > max_time) {
       max_time = time;
-      max_size = size;
+      max_size = task.size;
     }
-    task_count++;
 #endif
   }
 
@@ -336,42 +532,483 @@ void taskMThread(std::mutex &Qmutex, std::priority_queue<TaskInfo> &taskQ,
     outs() << "\tThread " << tid << "\ttime:\t" << duration.count() << " us\n";
     outs() << "\t\tMax task time :\t " << max_time << " us with\t " << max_size
            << " BBs\n";
-    outs() << "\t\tTasks processed:\t" << task_count << "\n";
+    outs() << "\t\tTasks processed:\t" << stats.tasks << "\n";
+    outs() << "\t\tSteals:\t" << stats.steals << "\tIdle:\t" << stats.idle
+           << "\tLock waits:\t" << stats.lockWaits << "\n";
+  }
+#endif
+}
+
+void WorkStealingTasks::run(
+    const std::vector<std::shared_ptr<FuncPass>> &passes, Module &module) {
+  preparePasses(passes, module, nthreads);
+  std::vector<TaskInfo> tasks;
+  std::vector<double> costs;
+  for (auto item : enumerate(module)) {
+    Function &func = item.value();
+    if (func.isDeclaration())
+      continue;
+    auto passCosts = taskCosts(passes, func);
+    if (wholeFuncs) {
+      double cost = 0;
+      for (double passCost : passCosts) {
+        cost += passCost;
+      }
+      tasks.push_back({nullptr, &func, func.size(), (int)item.index(), cost});
+      costs.push_back(cost);
+      continue;
+    }
+    for (auto [pass, cost] : zip(passes, passCosts)) {
+      tasks.push_back({pass, &func, func.size(), (int)item.index(), cost});
+      costs.push_back(cost);
+    }
+  }
+  std::stable_sort(tasks.begin(), tasks.end(),
+                   [](const TaskInfo &lhs, const TaskInfo &rhs) {
+                     return rhs < lhs;
+                   });
+
+  std::vector<TaskDeque> deques(nthreads);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    deques[i % nthreads].tasks.push_back(std::move(tasks[i]));
+  }
+
+  std::vector<StealStats> stats(nthreads);
+  auto start = std::chrono::high_resolution_clock::now();
+  runWorkers(nthreads,
+             [&](int tid) { stealThread(passes, deques, stats[tid], tid); });
+  auto end = std::chrono::high_resolution_clock::now();
+
+  StealStats total;
+  for (auto &s : stats) {
+    total.steals += s.steals;
+    total.idle += s.idle;
+    total.lockWaits += s.lockWaits;
+  }
+  outs() << "\tSteals: " << total.steals << "\tIdle: " << total.idle
+         << "\tLock waits: " << total.lockWaits << "\n";
+  reportMakespan(
+      costs, nthreads,
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count());
+}
+
+void waveThread(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                const std::vector<std::vector<Function *>> &sccFuncs,
+                WaveQueue &queue, std::vector<long> &times, int tid) {
+#ifdef PRINT_STATS
+  auto start = std::chrono::high_resolution_clock::now();
+  int task_count = 0;
+#endif
+
+  while (true) {
+    unsigned scc;
+    {
+      TraceScope wait("queue", "wait");
+      if (!queue.take(scc))
+        break;
+    }
+
+    auto sub_start = std::chrono::high_resolution_clock::now();
+    for (Function *func : sccFuncs[scc]) {
+      for (auto pass : passes) {
+        pass->runTask(*func);
+      }
+    }
+    auto sub_end = std::chrono::high_resolution_clock::now();
+    times[scc] = std::chrono::duration_cast<std::chrono::microseconds>(
+                     sub_end - sub_start)
+                     .count();
+#ifdef PRINT_STATS
+    task_count++;
+#endif
+
+    queue.finish(scc);
+  }
+
+#ifdef PRINT_STATS
+  auto end = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+  {
+    std::lock_guard<std::mutex> lock(outsmtx);
+    outs() << "\tThread " << tid << "\ttime:\t" << duration.count() << " us\n";
+    outs() << "\t\tSCCs processed:\t" << task_count << "\n";
+  }
+#endif
+}
+
+void CallGraphWaves::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                         Module &module) {
+  preparePasses(passes, module, nthreads);
+  std::vector<Function *> funcs;
+  DenseMap<const Function *, unsigned> funcIds;
+  for (auto &func : module) {
+    if (func.isDeclaration())
+      continue;
+    funcIds[&func] = funcs.size();
+    funcs.push_back(&func);
+  }
+  std::vector<std::vector<unsigned>> succs(funcs.size());
+  for (unsigned f = 0; f < funcs.size(); ++f) {
+    for (auto &BB : *funcs[f]) {
+      for (auto &inst : BB) {
+        auto *call = dyn_cast<CallBase>(&inst);
+        if (!call)
+          continue;
+        auto *callee = dyn_cast<Function>(
+            call->getCalledOperand()->stripPointerCasts());
+        auto it = callee ? funcIds.find(callee) : funcIds.end();
+        if (it != funcIds.end())
+          succs[f].push_back(it->second);
+      }
+    }
+  }
+  std::vector<unsigned> sccOf;
+  auto sccs = findSCCs(succs, sccOf);
+  unsigned nsccs = sccs.size();
+
+  // waitsFor[s]: the SCCs released before s, dependents the reverse
+  std::vector<std::vector<unsigned>> waitsFor(nsccs), dependents(nsccs);
+  for (unsigned f = 0; f < funcs.size(); ++f) {
+    for (unsigned t : succs[f]) {
+      unsigned caller = sccOf[f], callee = sccOf[t];
+      if (caller == callee)
+        continue;
+      if (order == WaveOrder::BottomUp)
+        waitsFor[caller].push_back(callee);
+      else
+        waitsFor[callee].push_back(caller);
+    }
+  }
+  for (unsigned s = 0; s < nsccs; ++s) {
+    auto &deps = waitsFor[s];
+    std::sort(deps.begin(), deps.end());
+    deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+    for (unsigned dep : deps) {
+      dependents[dep].push_back(s);
+    }
+  }
+
+  // SCCs come callees first, so that is release order for BottomUp and the
+  // reverse of it for TopDown
+  std::vector<unsigned> released(nsccs);
+  for (unsigned s = 0; s < nsccs; ++s) {
+    released[s] = order == WaveOrder::BottomUp ? s : nsccs - 1 - s;
+  }
+  std::vector<std::vector<Function *>> sccFuncs(nsccs);
+  std::vector<double> paths(nsccs, 0);
+  for (auto it = released.rbegin(); it != released.rend(); ++it) {
+    unsigned s = *it;
+    double cost = 0;
+    for (unsigned f : sccs[s]) {
+      sccFuncs[s].push_back(funcs[f]);
+      for (double passCost : taskCosts(passes, *funcs[f])) {
+        cost += passCost;
+      }
+    }
+    double longest = 0;
+    for (unsigned dependent : dependents[s]) {
+      longest = std::max(longest, paths[dependent]);
+    }
+    paths[s] = cost + longest;
+  }
+
+  // ready SCCs go longest remaining path first
+  WaveQueue queue(waitsFor, paths);
+  std::vector<long> times(nsccs, 0);
+  auto start = std::chrono::high_resolution_clock::now();
+  runWorkers(nthreads, [&](int tid) {
+    waveThread(passes, sccFuncs, queue, times, tid);
+  });
+  auto end = std::chrono::high_resolution_clock::now();
+
+  // measured span: longest chain of dependent SCC times
+  stats = WaveStats();
+  stats.sccs = nsccs;
+  stats.wall =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  std::vector<long> spans(nsccs, 0);
+  std::vector<size_t> depths(nsccs, 0);
+  for (unsigned s : released) {
+    long longest = 0;
+    size_t deepest = 0;
+    for (unsigned dep : waitsFor[s]) {
+      longest = std::max(longest, spans[dep]);
+      deepest = std::max(deepest, depths[dep]);
+    }
+    spans[s] = longest + times[s];
+    depths[s] = deepest + 1;
+    stats.work += times[s];
+    stats.span = std::max(stats.span, spans[s]);
+    stats.depth = std::max(stats.depth, depths[s]);
+    stats.largest = std::max(stats.largest, sccs[s].size());
+  }
+  outs() << "\tSCCs: " << stats.sccs << "\tLargest: " << stats.largest
+         << "\tDepth: " << stats.depth << "\n";
+  outs() << "\tCritical path: " << stats.span << " us of " << stats.work
+         << " us work\tParallelism: " << format("%.2f", stats.parallelism())
+         << " achieved, " << format("%.2f", stats.maxParallelism())
+         << " bound\n";
+}
+
+// Each worker gets its own LLVMContext and a module holding only the bodies
+// of its partition, so nothing (types, constants, use lists, allocator) is
+// shared between workers once they start.
+void moduleThread(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                  MemoryBufferRef bitcode, int tid) {
+#ifdef PRINT_STATS
+  auto start = std::chrono::high_resolution_clock::now();
+  int task_count = 0;
+#endif
+
+  LLVMContext context;
+  auto module = [&] {
+    TraceScope parse("setup", "parse");
+    return parseBitcodeFile(bitcode, context);
+  }();
+  if (!module) {
+    std::lock_guard<std::mutex> lock(outsmtx);
+    errs() << "Cannot parse partition " << tid << ": "
+           << toString(module.takeError()) << "\n";
+    return;
+  }
+
+  for (auto &func : **module) {
+    if (func.isDeclaration())
+      continue;
+    for (auto pass : passes) {
+      pass->runTask(func);
+    }
+#ifdef PRINT_STATS
+    task_count++;
+#endif
+  }
+
+#ifdef PRINT_STATS
+  auto end = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+  {
+    std::lock_guard<std::mutex> lock(outsmtx);
+    outs() << "\tThread " << tid << "\ttime:\t" << duration.count() << " us\n";
+    outs() << "\t\tFuncs processed:\t" << task_count << "\n";
   }
 #endif
 }
 
+void ConcurrentModules::run(
+    const std::vector<std::shared_ptr<FuncPass>> &passes, Module &module) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // LPT assignment of functions to partitions by predicted cost
+  std::vector<std::pair<double, Function *>> funcs;
+  for (auto &func : module) {
+    if (func.isDeclaration())
+      continue;
+    double cost = 0;
+    for (double passCost : taskCosts(passes, func)) {
+      cost += passCost;
+    }
+    funcs.push_back({cost, &func});
+  }
+  std::stable_sort(funcs.begin(), funcs.end(),
+                   [](const auto &lhs, const auto &rhs) {
+                     return lhs.first > rhs.first;
+                   });
+  std::vector<double> loads(nthreads, 0);
+  DenseMap<const Function *, unsigned> partOf;
+  std::vector<double> costs;
+  for (auto &[cost, func] : funcs) {
+    unsigned part = std::min_element(loads.begin(), loads.end()) -
+                    loads.begin();
+    loads[part] += cost;
+    partOf[func] = part;
+    costs.push_back(cost);
+  }
+
+  // Every partition keeps all globals and declarations but only its own
+  // function bodies, and travels to its worker as bitcode.
+  std::vector<SmallVector<char, 0>> bitcodes(nthreads);
+  for (unsigned part = 0; part < nthreads; ++part) {
+    TraceScope split("setup", "split");
+    ValueToValueMapTy VMap;
+    auto partModule =
+        CloneModule(module, VMap, [&](const GlobalValue *gv) {
+          auto *func = dyn_cast<Function>(gv);
+          return !func || partOf.lookup(func) == part;
+        });
+    raw_svector_ostream os(bitcodes[part]);
+    WriteBitcodeToFile(*partModule, os);
+  }
+
+  auto split = std::chrono::high_resolution_clock::now();
+  runWorkers(nthreads, [&](int tid) {
+    MemoryBufferRef bitcode(
+        StringRef(bitcodes[tid].data(), bitcodes[tid].size()),
+        module.getModuleIdentifier());
+    moduleThread(passes, bitcode, tid);
+  });
+  auto end = std::chrono::high_resolution_clock::now();
+
+  outs() << "\tSplit time: "
+         << std::chrono::duration_cast<std::chrono::microseconds>(split - start)
+                .count()
+         << " us\n";
+  reportMakespan(
+      costs, nthreads,
+      std::chrono::duration_cast<std::chrono::microseconds>(end - split)
+          .count());
+}
+
 void ConcurrentModules::runOnFile(
     const std::vector<std::shared_ptr<FuncPass>> &passes,
     const std::string &filename) {
-  
-    std::priority_queue<TaskInfo> taskQ;
-
-  // for (auto [i, func] : enumerate(module)) {
-  //   for (auto pass : passes) {
-  //     if (func.isDeclaration())
-  //       continue;
-  //     taskQ.push({pass, &func, func.size(), (int)i});
-  //   }
-  // }
-
-  // std::mutex Qmutex;
-  // std::vector<std::thread> threads;
-  // threads.reserve(nthreads);
-  // for (int i = 0; i < nthreads; ++i) {
-  //   threads.emplace_back(taskThread, std::ref(Qmutex), std::ref(taskQ),
-  //                        i);
-  // }
-  // for (auto &t : threads) {
-  //   t.join();
-  // }
-
-  // int nthreads = passes.size();
-  // std::vector<std::thread> threads;
-  // for (auto pass : passes) {
-  //   threads.emplace_back(passMThread, pass, std::ref(filename));
-  // }
-  // for (auto &t : threads) {
-  //   t.join();
-  // }
+  LLVMContext context;
+  SMDiagnostic smd;
+  std::unique_ptr<Module> module = parseIRFile(filename, smd, context);
+  if (!module) {
+    outs() << "Cannot parse IR file\n";
+    smd.print(filename.c_str(), outs());
+    return;
+  }
+  run(passes, *module);
+}
+
+// Linux only: writing 5 to clear_refs resets VmHWM to the current RSS.
+void resetPeakRSS() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+long procStatusKB(const std::string &field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, field.size(), field) == 0)
+      return std::strtol(line.c_str() + field.size() + 1, nullptr, 10);
+  }
+  return -1;
+}
+
+struct LazyState {
+  std::shared_mutex lock;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> started{false};
+  std::chrono::high_resolution_clock::time_point firstTask;
+};
+
+void lazyThread(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                std::vector<Function *> &funcs, LazyState &state,
+                LoadMode mode, int tid) {
+#ifdef PRINT_STATS
+  auto start = std::chrono::high_resolution_clock::now();
+  int task_count = 0;
+#endif
+
+  while (true) {
+    size_t i = state.next.fetch_add(1);
+    if (i >= funcs.size())
+      break;
+    Function &func = *funcs[i];
+    if (func.isMaterializable()) {
+      TraceScope materialize("queue", "materialize", &func);
+      std::unique_lock<std::shared_mutex> excl(state.lock);
+      if (Error err = func.materialize()) {
+        std::lock_guard<std::mutex> lock(outsmtx);
+        errs() << "Cannot materialize " << func.getName() << ": "
+               << toString(std::move(err)) << "\n";
+        continue;
+      }
+    }
+    if (func.isDeclaration())
+      continue;
+
+    {
+      std::shared_lock<std::shared_mutex> shared(state.lock, std::defer_lock);
+      {
+        // materializing on another thread drains running tasks first
+        TraceScope wait("queue", "wait");
+        shared.lock();
+      }
+      if (!state.started.exchange(true))
+        state.firstTask = std::chrono::high_resolution_clock::now();
+      for (auto pass : passes) {
+        pass->runTask(func);
+      }
+    }
+#ifdef PRINT_STATS
+    task_count++;
+#endif
+
+    if (mode == LoadMode::LazyDematerialize) {
+      std::unique_lock<std::shared_mutex> excl(state.lock);
+      func.deleteBody();
+    }
+  }
+
+#ifdef PRINT_STATS
+  auto end = std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+  {
+    std::lock_guard<std::mutex> lock(outsmtx);
+    outs() << "\tThread " << tid << "\ttime:\t" << duration.count() << " us\n";
+    outs() << "\t\tFuncs processed:\t" << task_count << "\n";
+  }
+#endif
+}
+
+std::unique_ptr<Module> LazyFuncs::load(const std::string &filename,
+                                        LLVMContext &context) {
+  baseRSS = procStatusKB("VmRSS:");
+  resetPeakRSS();
+  auto start = std::chrono::high_resolution_clock::now();
+  SMDiagnostic smd;
+  std::unique_ptr<Module> module =
+      mode == LoadMode::Eager ? parseIRFile(filename, smd, context)
+                              : getLazyIRFileModule(filename, smd, context);
+  if (!module) {
+    outs() << "Cannot parse IR file\n";
+    smd.print(filename.c_str(), outs());
+    return nullptr;
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  loadMicros =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  loaded = true;
+  return module;
+}
+
+void LazyFuncs::run(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                    Module &module) {
+  auto start = std::chrono::high_resolution_clock::now();
+  LazyState state;
+  std::vector<Function *> funcs;
+  for (auto &func : module) {
+    if (!func.isDeclaration())
+      funcs.push_back(&func);
+  }
+  runWorkers(nthreads, [&](int tid) {
+    lazyThread(passes, funcs, state, mode, tid);
+  });
+  auto end = std::chrono::high_resolution_clock::now();
+
+  auto us = [&](std::chrono::high_resolution_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - start)
+        .count();
+  };
+  outs() << "\t";
+  if (loaded)
+    outs() << "Load: " << loadMicros << " us\t";
+  outs() << "First task: " << (state.started ? us(state.firstTask) : -1)
+         << " us\tRun: " << us(end) << " us\n";
+  if (loaded) {
+    long peakRSS = procStatusKB("VmHWM:");
+    outs() << "\tPeak RSS: " << peakRSS << " kB (+" << peakRSS - baseRSS
+           << " kB)\n";
+    loaded = false;
+  }
 }
@@ -1,22 +1,61 @@
 #pragma once
 
+#include "costmodel.hpp"
 #include "passman.hpp"
+#include "threadpool.hpp"
 
 #include "llvm/IR/Module.h"
 
 #include <cassert>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 class Scheduler {
+protected:
+  ThreadPool *pool = nullptr;
+  const CostModel *costModel = nullptr;
+  unsigned splitBBs = 0;
+
+  // Predicted cost of each pass on func, the BB count without a model.
+  std::vector<double>
+  taskCosts(const std::vector<std::shared_ptr<FuncPass>> &passes,
+            llvm::Function &func) const;
+  // Print the LPT makespan the model predicts next to the measured one.
+  void reportMakespan(const std::vector<double> &costs, unsigned nworkers,
+                      long actual) const;
+
+  void preparePasses(const std::vector<std::shared_ptr<FuncPass>> &passes,
+                     llvm::Module &module, unsigned nthreads);
+  // Run worker(tid) for tid in [0, nworkers) and wait for all of them, on
+  // the borrowed pool if there is one and on fresh threads otherwise.
+  void runWorkers(unsigned nworkers, const std::function<void(int)> &worker);
+  // runWorkers() for passes to prepare() on
+  WorkerRunner workerRunner();
+
 public:
   virtual ~Scheduler() = default;
   virtual void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
                    llvm::Module &module) = 0;
+
+  // The pool must outlive every run that uses it.
+  void setPool(ThreadPool *newpool) { pool = newpool; }
+  // Order tasks by predicted cost instead of BB count.
+  void setCostModel(const CostModel *newmodel) { costModel = newmodel; }
+  // Split tasks on functions of at least this many BBs into parts that
+  // run in parallel (FuncPass::split), 0 for never. Only ConcurrentTasks
+  // splits.
+  void setSplitBBs(unsigned count) { splitBBs = count; }
 };
 
+// Runs every task alone and writes its time to a csv for CostModel::train.
 class TaskTimer : public Scheduler {
+private:
+  std::string csvname;
+
 public:
+  explicit TaskTimer(std::string csvname) : csvname(std::move(csvname)) {}
   void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
            llvm::Module &module) override;
 };
@@ -27,6 +66,8 @@ public:
            llvm::Module &module) override;
 };
 
+// Splits the module into nthreads partitions balanced by function cost and
+// analyzes each in its own LLVMContext on its own thread.
 class ConcurrentModules : public Scheduler {
 private:
   unsigned nthreads;
@@ -35,9 +76,7 @@ public:
   ConcurrentModules() : nthreads(4) {}
   explicit ConcurrentModules(unsigned num_threads) : nthreads(num_threads) {}
   void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
-           llvm::Module &module) {
-    exit(1);
-  }
+           llvm::Module &module) override;
   void runOnFile(const std::vector<std::shared_ptr<FuncPass>> &passes,
                  const std::string &filename);
 };
@@ -59,6 +98,10 @@ public:
            llvm::Module &module) override;
 };
 
+// One (pass, function) task at a time from a queue ordered by cost. A task
+// on a function of at least splitBBs blocks is split into parts that go
+// back into the queue at the task's cost, so idle workers pick them up
+// before anything smaller; whoever finishes the last part joins them.
 class ConcurrentTasks : public Scheduler {
 private:
   unsigned nthreads;
@@ -69,3 +112,94 @@ public:
   void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
            llvm::Module &module) override;
 };
+
+// Per-worker deques with stealing instead of one locked priority queue.
+// With whole_funcs set a task runs every pass on one function, like
+// ConcurrentFuncs; otherwise it is one (pass, function) pair, like
+// ConcurrentTasks.
+class WorkStealingTasks : public Scheduler {
+private:
+  unsigned nthreads;
+  bool wholeFuncs;
+
+public:
+  WorkStealingTasks() : nthreads(4), wholeFuncs(false) {}
+  explicit WorkStealingTasks(unsigned num_threads, bool whole_funcs = false)
+      : nthreads(num_threads), wholeFuncs(whole_funcs) {}
+  void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
+           llvm::Module &module) override;
+};
+
+// BottomUp releases an SCC once its callees are done, TopDown once its
+// callers are.
+enum class WaveOrder { BottomUp, TopDown };
+
+// Critical path and parallelism of the last CallGraphWaves run. work and
+// span are measured task times; span is the longest chain of dependent
+// SCCs.
+struct WaveStats {
+  size_t sccs = 0;
+  size_t largest = 0;
+  // SCCs on the longest dependency chain
+  size_t depth = 0;
+  long work = 0;
+  long span = 0;
+  long wall = 0;
+
+  // what the run achieved, and the most any number of workers could
+  double parallelism() const { return wall ? double(work) / wall : 0; }
+  double maxParallelism() const { return span ? double(work) / span : 0; }
+};
+
+// Runs every pass on the functions of one call-graph SCC per task, for
+// passes that need their callees (or callers) analyzed first. Edges are
+// direct calls. Each SCC counts its pending dependencies and is queued
+// when the count drops to zero, so there is no barrier between levels;
+// ready SCCs go longest predicted path first.
+class CallGraphWaves : public Scheduler {
+private:
+  unsigned nthreads;
+  WaveOrder order;
+  WaveStats stats;
+
+public:
+  CallGraphWaves() : nthreads(4), order(WaveOrder::BottomUp) {}
+  explicit CallGraphWaves(unsigned num_threads,
+                          WaveOrder wave_order = WaveOrder::BottomUp)
+      : nthreads(num_threads), order(wave_order) {}
+  void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
+           llvm::Module &module) override;
+  const WaveStats &lastStats() const { return stats; }
+};
+
+enum class LoadMode { Eager, Lazy, LazyDematerialize };
+
+// Runs every pass on one function per task, in module order. When the module
+// was loaded lazily, workers materialize each body right before its task and,
+// with LazyDematerialize, delete it once its passes are done; deleted bodies
+// are gone from the module for later runs. Materializing edits the use lists
+// of shared globals, so it waits for running tasks to drain, and passes that
+// walk those use lists (0-CFA) only see the bodies resident at that moment.
+class LazyFuncs : public Scheduler {
+private:
+  unsigned nthreads;
+  LoadMode mode;
+  // set by load(), reported and cleared by the next run()
+  bool loaded = false;
+  long baseRSS = 0;
+  long loadMicros = 0;
+
+public:
+  LazyFuncs() : nthreads(4), mode(LoadMode::Lazy) {}
+  explicit LazyFuncs(unsigned num_threads, LoadMode load_mode = LoadMode::Lazy)
+      : nthreads(num_threads), mode(load_mode) {}
+  // Reports the time to first task and, after load(), the load time and
+  // peak RSS.
+  void run(const std::vector<std::shared_ptr<FuncPass>> &passes,
+           llvm::Module &module) override;
+  // Load filename according to the mode, or print why not and return
+  // nullptr.
+  std::unique_ptr<llvm::Module> load(const std::string &filename,
+                                     llvm::LLVMContext &context);
+  long lastLoadMicros() const { return loadMicros; }
+};
@@ -0,0 +1,75 @@
+#include "threadpool.hpp"
+
+#include <cassert>
+
+void ThreadPool::workerLoop(unsigned tid, uint64_t seen) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [&] {
+      return stopping || tid >= limit || (generation != seen && tid < active);
+    });
+    if (stopping || tid >= limit)
+      return;
+    seen = generation;
+    const std::function<void(int)> *worker = job;
+    lock.unlock();
+
+    (*worker)(tid);
+
+    lock.lock();
+    if (--pending == 0)
+      done.notify_all();
+  }
+}
+
+void ThreadPool::resize(unsigned nthreads) {
+  std::unique_lock<std::mutex> lock(mutex);
+  assert(!job && "resize during a run");
+  unsigned old = workers.size();
+  limit = nthreads;
+  if (nthreads < old) {
+    wake.notify_all();
+    lock.unlock();
+    for (unsigned i = nthreads; i < old; ++i) {
+      workers[i].join();
+    }
+    workers.resize(nthreads);
+    return;
+  }
+  for (unsigned i = old; i < nthreads; ++i) {
+    workers.emplace_back(&ThreadPool::workerLoop, this, i, generation);
+  }
+}
+
+void ThreadPool::run(unsigned nworkers,
+                     const std::function<void(int)> &worker) {
+  if (nworkers == 0)
+    return;
+  if (nworkers > workers.size())
+    resize(nworkers);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  job = &worker;
+  active = nworkers;
+  pending = nworkers;
+  generation++;
+  wake.notify_all();
+  done.wait(lock, [&] { return pending == 0; });
+  job = nullptr;
+  active = 0;
+}
+
+void ThreadPool::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &t : workers) {
+    t.join();
+  }
+  workers.clear();
+  std::lock_guard<std::mutex> lock(mutex);
+  stopping = false;
+  limit = 0;
+}
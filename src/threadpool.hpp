@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived worker threads that schedulers borrow instead of spawning and
+// joining their own on every run. Idle workers park on a condition variable
+// until the next job; a job runs worker(tid) on the first nworkers threads
+// and run() returns once all of them have finished.
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(int)> *job = nullptr;
+  unsigned active = 0;  // workers taking part in the current job
+  unsigned pending = 0; // of those, the ones still running
+  unsigned limit = 0;   // workers with tid >= limit exit
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  void workerLoop(unsigned tid, uint64_t seen);
+
+public:
+  explicit ThreadPool(unsigned nthreads = 0) { resize(nthreads); }
+  ~ThreadPool() { shutdown(); }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return workers.size(); }
+  // Grow or shrink the pool. Only valid between runs.
+  void resize(unsigned nthreads);
+  // Run worker(tid) for tid in [0, nworkers), growing the pool if needed.
+  void run(unsigned nworkers, const std::function<void(int)> &worker);
+  // Wake and join every worker. The pool is empty afterwards.
+  void shutdown();
+};
@@ -0,0 +1,416 @@
+// Synthetic module generator for scaling benchmarks. Functions are built
+// directly in SSA form from nested if/else diamonds and loops, so the CFG
+// shape, phi density, memory traffic and call mix can be set independently.
+
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::OptionCategory GenCategory("irgen options");
+
+static cl::opt<std::string> OutputFile("o", cl::Required,
+                                       cl::desc("Output file, .ll for text"),
+                                       cl::value_desc("filename"),
+                                       cl::cat(GenCategory));
+
+static cl::opt<std::string>
+    Stress("stress",
+           cl::desc("Preset that stresses one pass: liveness, points-to, "
+                    "0-CFA, slicing; explicit options still override it"),
+           cl::cat(GenCategory));
+
+static cl::opt<unsigned> Seed("seed", cl::init(1),
+                              cl::desc("Random seed; equal seeds and options "
+                                       "give equal modules"),
+                              cl::cat(GenCategory));
+
+static cl::opt<unsigned> NumFuncs("funcs", cl::init(100),
+                                  cl::desc("Number of functions"),
+                                  cl::cat(GenCategory));
+
+static cl::opt<std::string>
+    BBDist("bb-dist", cl::init("uniform"),
+           cl::desc("Distribution of BBs per function: uniform or pareto"),
+           cl::cat(GenCategory));
+
+static cl::opt<unsigned> MinBBs("min-bbs", cl::init(4),
+                                cl::desc("Smallest function, also the Pareto "
+                                         "scale"),
+                                cl::cat(GenCategory));
+
+static cl::opt<unsigned> MaxBBs("max-bbs", cl::init(64),
+                                cl::desc("Largest function"),
+                                cl::cat(GenCategory));
+
+static cl::opt<double> ParetoAlpha("pareto-alpha", cl::init(1.2),
+                                   cl::desc("Tail index for --bb-dist=pareto"),
+                                   cl::cat(GenCategory));
+
+static cl::opt<unsigned> LoopDepth("loop-depth", cl::init(3),
+                                   cl::desc("Maximum loop nesting"),
+                                   cl::cat(GenCategory));
+
+static cl::opt<double> LoopRate("loop-rate", cl::init(0.3),
+                                cl::desc("Share of control constructs that "
+                                         "are loops rather than diamonds"),
+                                cl::cat(GenCategory));
+
+static cl::opt<unsigned> PhisPerJoin("phis", cl::init(2),
+                                     cl::desc("Phis per join and loop header"),
+                                     cl::cat(GenCategory));
+
+static cl::opt<double> InstsPerBB("insts-per-bb", cl::init(6),
+                                  cl::desc("Arithmetic per block, on average"),
+                                  cl::cat(GenCategory));
+
+static cl::opt<unsigned> Allocas("allocas", cl::init(4),
+                                 cl::desc("Allocas per function"),
+                                 cl::cat(GenCategory));
+
+static cl::opt<double> GEPs("geps", cl::init(1),
+                            cl::desc("GEPs per block, on average"),
+                            cl::cat(GenCategory));
+
+static cl::opt<double> Loads("loads", cl::init(1),
+                             cl::desc("Loads per block, on average"),
+                             cl::cat(GenCategory));
+
+static cl::opt<double> Stores("stores", cl::init(1),
+                              cl::desc("Stores per block, on average"),
+                              cl::cat(GenCategory));
+
+static cl::opt<double>
+    IndirectCalls("indirect-calls", cl::init(0.2),
+                  cl::desc("Calls through the handler table per block"),
+                  cl::cat(GenCategory));
+
+static cl::opt<double> DirectCalls("direct-calls", cl::init(0.1),
+                                   cl::desc("Calls to earlier functions per "
+                                            "block"),
+                                   cl::cat(GenCategory));
+
+static cl::opt<unsigned>
+    ChainDepth("chain-depth", cl::init(2),
+               cl::desc("Length of the bitcast/GEP chains off pointers"),
+               cl::cat(GenCategory));
+
+static cl::opt<unsigned> Handlers("handlers", cl::init(4),
+                                  cl::desc("Functions in the handler table"),
+                                  cl::cat(GenCategory));
+
+// Only options left at their default take the preset's value.
+template <typename T> void preset(cl::opt<T> &option, T value) {
+  if (option.getNumOccurrences() == 0)
+    option = value;
+}
+
+bool applyStress() {
+  if (Stress.empty())
+    return true;
+  if (Stress == "liveness") {
+    // many blocks, values live across loops, little memory
+    preset<unsigned>(MaxBBs, 512);
+    preset<unsigned>(LoopDepth, 5);
+    preset<double>(LoopRate, 0.5);
+    preset<unsigned>(PhisPerJoin, 8);
+    preset<double>(Loads, 0.2);
+    preset<double>(Stores, 0.2);
+  } else if (Stress == "points-to") {
+    // pointer phis in loops, heavy load/store traffic
+    preset<unsigned>(Allocas, 32);
+    preset<double>(GEPs, 4);
+    preset<double>(Loads, 4);
+    preset<double>(Stores, 4);
+    preset<unsigned>(PhisPerJoin, 4);
+  } else if (Stress == "0-CFA") {
+    // indirect calls through long cast/load chains
+    preset<double>(IndirectCalls, 3);
+    preset<unsigned>(ChainDepth, 16);
+    preset<unsigned>(Handlers, 32);
+  } else if (Stress == "slicing") {
+    // long def-use chains hanging off GEPs
+    preset<double>(GEPs, 6);
+    preset<double>(InstsPerBB, 16);
+    preset<unsigned>(ChainDepth, 8);
+  } else {
+    errs() << "Unknown stress preset " << Stress << "\n";
+    return false;
+  }
+  return true;
+}
+
+struct Generator {
+  Module &module;
+  LLVMContext &ctx;
+  std::mt19937_64 rng;
+  IRBuilder<> builder;
+  Type *i32;
+  PointerType *i32Ptr;
+  FunctionType *funcType, *handlerType;
+  GlobalVariable *table = nullptr;
+  std::vector<Function *> funcs;
+
+  // values usable at the insertion point; inner regions truncate back
+  std::vector<Value *> ints, ptrs;
+  Function *func = nullptr;
+  Value *bound = nullptr;
+
+  Generator(Module &module)
+      : module(module), ctx(module.getContext()), rng(Seed), builder(ctx) {
+    i32 = Type::getInt32Ty(ctx);
+    i32Ptr = Type::getInt32PtrTy(ctx);
+    funcType = FunctionType::get(i32, {i32Ptr, i32}, false);
+    handlerType = FunctionType::get(Type::getVoidTy(ctx), {i32Ptr}, false);
+  }
+
+  double uniform() { return std::uniform_real_distribution<double>()(rng); }
+  unsigned below(size_t n) { return rng() % n; }
+  // a Poisson-distributed count with the given mean
+  unsigned count(double mean) {
+    return mean > 0 ? std::poisson_distribution<unsigned>(mean)(rng) : 0;
+  }
+  Value *anyInt() { return ints[below(ints.size())]; }
+  Value *anyPtr() { return ptrs[below(ptrs.size())]; }
+
+  unsigned sampleBBs() {
+    unsigned lo = std::max(1u, (unsigned)MinBBs);
+    unsigned hi = std::max(lo, (unsigned)MaxBBs);
+    if (BBDist == "pareto") {
+      double x = lo / std::pow(1 - uniform(), 1 / (double)ParetoAlpha);
+      return std::min<double>(hi, x);
+    }
+    return lo + below(hi - lo + 1);
+  }
+
+  void makeHandlers() {
+    auto *gp = new GlobalVariable(module, i32Ptr, false,
+                                  GlobalValue::ExternalLinkage,
+                                  ConstantPointerNull::get(i32Ptr), "gp");
+    std::vector<Constant *> entries;
+    for (unsigned h = 0; h < std::max(1u, (unsigned)Handlers); ++h) {
+      auto *handler =
+          Function::Create(handlerType, GlobalValue::ExternalLinkage,
+                           "h" + std::to_string(h), module);
+      builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", handler));
+      Value *arg = handler->getArg(0);
+      builder.CreateStore(ConstantInt::get(i32, h), arg);
+      builder.CreateStore(arg, gp);
+      builder.CreateRetVoid();
+      entries.push_back(handler);
+    }
+    auto *tableType = ArrayType::get(handlerType->getPointerTo(),
+                                     entries.size());
+    table = new GlobalVariable(module, tableType, true,
+                               GlobalValue::ExternalLinkage,
+                               ConstantArray::get(tableType, entries), "tab");
+  }
+
+  // alternating bitcast/GEP chain of the configured depth off a pointer
+  Value *chain(Value *ptr) {
+    for (unsigned d = 0; d < ChainDepth; ++d) {
+      if (d % 2 == 0)
+        ptr = builder.CreateBitCast(ptr, Type::getInt8PtrTy(ctx));
+      else
+        ptr = builder.CreateGEP(builder.getInt8Ty(), ptr, builder.getInt32(0));
+    }
+    return builder.CreateBitCast(ptr, i32Ptr);
+  }
+
+  void straightLine() {
+    for (unsigned i = count(GEPs); i > 0; --i) {
+      ptrs.push_back(builder.CreateGEP(i32, anyPtr(), anyInt()));
+    }
+    for (unsigned i = count(Loads); i > 0; --i) {
+      ints.push_back(builder.CreateLoad(i32, chain(anyPtr())));
+    }
+    for (unsigned i = count(InstsPerBB); i > 0; --i) {
+      Value *a = anyInt(), *b = anyInt();
+      switch (below(3)) {
+      case 0:
+        ints.push_back(builder.CreateAdd(a, b));
+        break;
+      case 1:
+        ints.push_back(builder.CreateMul(a, b));
+        break;
+      default:
+        ints.push_back(builder.CreateSelect(builder.CreateICmpSLT(a, b), a, b));
+        break;
+      }
+    }
+    for (unsigned i = count(Stores); i > 0; --i) {
+      builder.CreateStore(anyInt(), anyPtr());
+    }
+    uint64_t size = table->getValueType()->getArrayNumElements();
+    for (unsigned i = count(IndirectCalls); i > 0; --i) {
+      Value *index[] = {ConstantInt::get(i32, 0),
+                        builder.CreateURem(anyInt(), builder.getInt32(size))};
+      Value *slot = builder.CreateGEP(table->getValueType(), table, index);
+      Value *callee = builder.CreateLoad(handlerType->getPointerTo(), slot);
+      builder.CreateCall(handlerType, callee, {chain(anyPtr())});
+    }
+    for (unsigned i = count(DirectCalls); i > 0 && !funcs.empty(); --i) {
+      Function *callee = funcs[below(funcs.size())];
+      ints.push_back(builder.CreateCall(callee, {anyPtr(), anyInt()}));
+    }
+  }
+
+  // phis merging one value per incoming edge, values picked at the end of
+  // each predecessor
+  void mergeValues(BasicBlock *join,
+                   const std::vector<std::pair<std::vector<Value *>,
+                                               BasicBlock *>> &incoming,
+                   std::vector<Value *> &pool, Type *type) {
+    builder.SetInsertPoint(join, join->getFirstInsertionPt());
+    for (unsigned p = 0; p < PhisPerJoin; ++p) {
+      auto *phi = builder.CreatePHI(type, incoming.size());
+      for (auto &[values, pred] : incoming) {
+        phi->addIncoming(values[below(values.size())], pred);
+      }
+      pool.push_back(phi);
+    }
+  }
+
+  void region(unsigned budget, unsigned depth) {
+    while (budget > 0) {
+      straightLine();
+      if (budget < 3)
+        return;
+      unsigned inner = 1 + below(std::max(1u, budget - 3));
+      budget -= 3 + std::min(inner, budget - 3);
+      if (depth < LoopDepth && uniform() < LoopRate)
+        loop(inner, depth);
+      else
+        diamond(inner, depth);
+    }
+  }
+
+  void diamond(unsigned budget, unsigned depth) {
+    auto *thenBB = BasicBlock::Create(ctx, "then", func);
+    auto *elseBB = BasicBlock::Create(ctx, "else", func);
+    auto *join = BasicBlock::Create(ctx, "join", func);
+    builder.CreateCondBr(builder.CreateICmpSLT(anyInt(), anyInt()), thenBB,
+                         elseBB);
+
+    size_t nints = ints.size(), nptrs = ptrs.size();
+    std::vector<std::pair<std::vector<Value *>, BasicBlock *>> intsIn, ptrsIn;
+    for (auto *BB : {thenBB, elseBB}) {
+      builder.SetInsertPoint(BB);
+      region(BB == thenBB ? budget / 2 : budget - budget / 2, depth);
+      intsIn.push_back({ints, builder.GetInsertBlock()});
+      ptrsIn.push_back({ptrs, builder.GetInsertBlock()});
+      builder.CreateBr(join);
+      ints.resize(nints);
+      ptrs.resize(nptrs);
+    }
+    mergeValues(join, intsIn, ints, i32);
+    mergeValues(join, ptrsIn, ptrs, i32Ptr);
+    builder.SetInsertPoint(join);
+  }
+
+  // Header phis carry the induction variable plus pointers and ints that
+  // the latch feeds from inside the body, which closes copy cycles.
+  void loop(unsigned budget, unsigned depth) {
+    BasicBlock *pre = builder.GetInsertBlock();
+    auto *header = BasicBlock::Create(ctx, "header", func);
+    auto *body = BasicBlock::Create(ctx, "body", func);
+    auto *exit = BasicBlock::Create(ctx, "exit", func);
+    builder.CreateBr(header);
+
+    builder.SetInsertPoint(header);
+    auto *iv = builder.CreatePHI(i32, 2);
+    iv->addIncoming(ConstantInt::get(i32, 0), pre);
+    std::vector<PHINode *> intPhis, ptrPhis;
+    for (unsigned p = 0; p < PhisPerJoin; ++p) {
+      intPhis.push_back(builder.CreatePHI(i32, 2));
+      intPhis.back()->addIncoming(anyInt(), pre);
+      ptrPhis.push_back(builder.CreatePHI(i32Ptr, 2));
+      ptrPhis.back()->addIncoming(anyPtr(), pre);
+    }
+    ints.push_back(iv);
+    ints.insert(ints.end(), intPhis.begin(), intPhis.end());
+    ptrs.insert(ptrs.end(), ptrPhis.begin(), ptrPhis.end());
+    builder.CreateCondBr(builder.CreateICmpSLT(iv, bound), body, exit);
+
+    size_t nints = ints.size(), nptrs = ptrs.size();
+    builder.SetInsertPoint(body);
+    region(budget, depth + 1);
+    BasicBlock *latch = builder.GetInsertBlock();
+    iv->addIncoming(builder.CreateAdd(iv, ConstantInt::get(i32, 1)), latch);
+    for (auto *phi : intPhis) {
+      phi->addIncoming(anyInt(), latch);
+    }
+    for (auto *phi : ptrPhis) {
+      phi->addIncoming(anyPtr(), latch);
+    }
+    builder.CreateBr(header);
+    ints.resize(nints);
+    ptrs.resize(nptrs);
+    builder.SetInsertPoint(exit);
+  }
+
+  void makeFunction(unsigned index) {
+    func = Function::Create(funcType, GlobalValue::ExternalLinkage,
+                            "f" + std::to_string(index), module);
+    builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", func));
+    ints = {func->getArg(1)};
+    ptrs = {func->getArg(0)};
+    bound = func->getArg(1);
+    for (unsigned a = 0; a < Allocas; ++a) {
+      ptrs.push_back(builder.CreateAlloca(i32));
+    }
+    region(sampleBBs(), 0);
+    builder.CreateRet(anyInt());
+    funcs.push_back(func);
+  }
+
+  void run() {
+    makeHandlers();
+    for (unsigned f = 0; f < NumFuncs; ++f) {
+      makeFunction(f);
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::HideUnrelatedOptions(GenCategory);
+  cl::ParseCommandLineOptions(argc, argv, "synthetic IR generator\n");
+  if (!applyStress())
+    return 1;
+
+  LLVMContext context;
+  Module module("irgen", context);
+  Generator(module).run();
+  if (verifyModule(module, &errs())) {
+    errs() << "Generated module is broken\n";
+    return 1;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream out(OutputFile, EC);
+  if (EC) {
+    errs() << "Cannot write " << OutputFile << ": " << EC.message() << "\n";
+    return 1;
+  }
+  if (StringRef(OutputFile).endswith(".ll"))
+    module.print(out, nullptr);
+  else
+    WriteBitcodeToFile(module, out);
+}